@@ -1,5 +1,6 @@
 #include <minix/ls.h>
 #include <minix/com.h>
+#include <lib.h>
 #include <sys/errno.h>
 #include <stdio.h>
 #include <string.h>
@@ -155,6 +156,484 @@ int main() {
 	ret = minix_ls_clear_logs("ScratchLog1,my_log");
 	assert( ret == LS_ERR_NO_SUCH_LOGGER );
 
+	// Test creating loggers from a template
+	ret = minix_ls_create_logger("Tenant1", "TenantLog", NULL);
+	assert( ret == OK );
+
+	ret = minix_ls_create_logger("Tenant2", "TenantLog", "severity = trace\nappend = false");
+	assert( ret == OK );
+
+	ret = minix_ls_start_log("Tenant2");
+	assert( ret == OK );
+
+	ret = minix_ls_write_log("Tenant2", "tenant msg", MINIX_LS_LEVEL_TRACE);
+	assert( ret == OK ); // We should see a line in /var/log/tenant.Tenant2.log
+
+	ret = minix_ls_close_log("Tenant2");
+	assert( ret == OK );
+
+	// Test creating a logger that already exists
+	ret = minix_ls_create_logger("FileLogger1", "TenantLog", NULL);
+	assert( ret == LS_ERR_LOGGER_EXISTS );
+
+	// Test creating a logger from a nonexistent template
+	ret = minix_ls_create_logger("Tenant3", "NoSuchTemplate", NULL);
+	assert( ret == LS_ERR_NO_SUCH_TEMPLATE );
+
+	// Test invalid overrides
+	ret = minix_ls_create_logger("Tenant3", "TenantLog", "bogus = 1");
+	assert( ret == -EINVAL );
+
+	// Test going over the max_dynamic_loggers limit
+	ret = minix_ls_create_logger("Tenant3", "TenantLog", NULL);
+	assert( ret == LS_ERR_LIMIT_REACHED );
+
+	// Test stats and rate limiting
+	minix_ls_stats_t stats;
+	ret = minix_ls_start_log("RateLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_write_log("RateLogger", "filtered", MINIX_LS_LEVEL_DEBUG);
+	assert( ret == OK );
+
+	for (int i = 0; i < 5; i++) {
+		ret = minix_ls_write_log("RateLogger", "rate limited msg", MINIX_LS_LEVEL_WARN);
+		assert( ret == OK ); // Only the first two should make it into the file
+	}
+
+	ret = minix_ls_close_log("RateLogger");
+	assert( ret == OK ); // Closing writes the "3 messages suppressed" line
+
+	ret = minix_ls_get_stats("RateLogger", &stats);
+	assert( ret == OK );
+	assert( stats.filtered == 1 );
+	assert( stats.suppressed == 3 );
+	assert( stats.written == 3 );
+
+	ret = minix_ls_get_stats("my_log", &stats);
+	assert( ret == LS_ERR_NO_SUCH_LOGGER );
+
+	// Test folding of repeated lines
+	ret = minix_ls_start_log("DedupLogger");
+	assert( ret == OK );
+
+	for (int i = 0; i < 4; i++) {
+		ret = minix_ls_write_log("DedupLogger", "same old line", MINIX_LS_LEVEL_INFO);
+		assert( ret == OK );
+	}
+
+	ret = minix_ls_write_log("DedupLogger", "a different line", MINIX_LS_LEVEL_INFO);
+	assert( ret == OK ); // Preceded by "last message repeated 3 times"
+
+	ret = minix_ls_close_log("DedupLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_get_stats("DedupLogger", &stats);
+	assert( ret == OK );
+	assert( stats.folded == 3 );
+	assert( stats.written == 3 );
+
+	// Test sampling of trace lines
+	ret = minix_ls_start_log("SampleLogger");
+	assert( ret == OK );
+
+	for (int i = 0; i < 1000; i++) {
+		ret = minix_ls_write_log("SampleLogger", "sampled trace line", MINIX_LS_LEVEL_TRACE);
+		assert( ret == OK );
+	}
+
+	ret = minix_ls_write_log("SampleLogger", "never sampled", MINIX_LS_LEVEL_INFO);
+	assert( ret == OK );
+
+	ret = minix_ls_close_log("SampleLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_get_stats("SampleLogger", &stats);
+	assert( ret == OK );
+	assert( stats.sampled > 0 && stats.written > 1 );
+	assert( stats.sampled + stats.written == 1001 );
+
+	// Test blocking on overflow; every line goes over the high watermark, so
+	// every write waits until ls has written it out
+	ret = minix_ls_start_log("BlockLogger");
+	assert( ret == OK );
+
+	for (int i = 0; i < 3; i++) {
+		ret = minix_ls_write_log("BlockLogger", "blocking line", MINIX_LS_LEVEL_INFO);
+		assert( ret == OK );
+
+		ret = minix_ls_get_stats("BlockLogger", &stats);
+		assert( ret == OK );
+		assert( stats.written == i + 1 );
+	}
+
+	ret = minix_ls_close_log("BlockLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_get_stats("BlockLogger", &stats);
+	assert( ret == OK );
+	assert( stats.blocked == 3 );
+	assert( stats.dropped == 0 );
+
+	// Test writing one logger to several destinations; a line counts once no
+	// matter how many destinations it goes to
+	ret = minix_ls_start_log("FanoutLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_write_log("FanoutLogger", "only in the main file", MINIX_LS_LEVEL_INFO);
+	assert( ret == OK );
+
+	ret = minix_ls_write_log("FanoutLogger", "in both files and on the console", MINIX_LS_LEVEL_WARN);
+	assert( ret == OK );
+
+	ret = minix_ls_close_log("FanoutLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_get_stats("FanoutLogger", &stats);
+	assert( ret == OK );
+	assert( stats.written == 2 );
+
+	// Test structured lines; the fields are rendered by ls
+	ret = minix_ls_start_log("KvLogger");
+	assert( ret == OK );
+
+	minix_ls_field_t fields[] = {
+		MINIX_LS_INT("bytes", -42),
+		MINIX_LS_STRING("path", "/tmp/a file"),
+		MINIX_LS_HEX("addr", 0xdeadbeef),
+		MINIX_LS_ENDPOINT("from", VFS_PROC_NR)
+	};
+	ret = minix_ls_write_kv("KvLogger", "request done", MINIX_LS_LEVEL_INFO, fields, 4);
+	assert( ret == OK ); // bytes=-42 path="/tmp/a file" addr=0xdeadbeef from=vfs(1)
+
+	minix_ls_field_t bad_key[] = { MINIX_LS_INT("", 1) };
+	ret = minix_ls_write_kv("KvLogger", "request done", MINIX_LS_LEVEL_INFO, bad_key, 1);
+	assert( ret == -EINVAL );
+
+	ret = minix_ls_close_log("KvLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_get_stats("KvLogger", &stats);
+	assert( ret == OK );
+	assert( stats.written == 1 );
+
+	// Test printf-style lines formatted by ls
+	int evaluated = 0;
+	ret = minix_ls_start_log("FormatLogger");
+	assert( ret == OK );
+
+	for (int i = 0; i < 3; i++) {
+		ret = minix_ls_writef("FormatLogger", MINIX_LS_LEVEL_INFO, "line %d of %s, %#06x", i, "FormatLogger", 0xab);
+		assert( ret == OK ); // Only the first of these registers the format
+	}
+
+	ret = minix_ls_writef("FormatLogger", MINIX_LS_LEVEL_TRACE, "never formatted %d", 1);
+	assert( ret == OK );
+
+	ret = minix_ls_writef("FormatLogger", MINIX_LS_LEVEL_INFO, "formatted here: %*d", 5, 42);
+	assert( ret == OK );
+
+	MINIX_LS_INFO("FormatLogger", "through the macro, evaluated %d", ++evaluated);
+	MINIX_LS_DEBUG("FormatLogger", "through the macro, never evaluated %d", ++evaluated);
+	assert( evaluated == 1 );
+
+	ret = minix_ls_close_log("FormatLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_get_stats("FormatLogger", &stats);
+	assert( ret == OK );
+	assert( stats.written == 5 );
+	assert( stats.filtered == 2 );
+
+	// Test lines buffered by the client and sent in batches
+	ret = minix_ls_start_log_buffered("BufferedLogger", 16, 0);
+	assert( ret == -EINVAL );
+
+	ret = minix_ls_start_log_buffered("BufferedLogger", 4096, 0);
+	assert( ret == OK );
+
+	for (int i = 0; i < 10; i++) {
+		ret = minix_ls_writef("BufferedLogger", MINIX_LS_LEVEL_INFO, "buffered line %d", i);
+		assert( ret == OK );
+	}
+	ret = minix_ls_write_log("BufferedLogger", "buffered too", MINIX_LS_LEVEL_TRACE);
+	assert( ret == OK );
+
+	ret = minix_ls_get_stats("BufferedLogger", &stats);
+	assert( ret == OK );
+	assert( stats.written == 0 ); // Still in the buffer
+
+	ret = minix_ls_flush("BufferedLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_get_stats("BufferedLogger", &stats);
+	assert( ret == OK );
+	assert( stats.written == 10 );
+	assert( stats.filtered == 1 );
+
+	ret = minix_ls_write_log("BufferedLogger", "flushed on close", MINIX_LS_LEVEL_WARN);
+	assert( ret == OK );
+
+	ret = minix_ls_close_log("BufferedLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_get_stats("BufferedLogger", &stats);
+	assert( ret == OK );
+	assert( stats.written == 11 );
+
+	// Test staging buffers, as two threads would use them
+	static char stage_buf1[512], stage_buf2[512];
+	minix_ls_stage_t stage1, stage2;
+
+	ret = minix_ls_stage_init(&stage1, "StageLogger", stage_buf1, sizeof(stage_buf1));
+	assert( ret == LS_ERR_LOGGER_NOT_OPEN );
+
+	ret = minix_ls_start_log("StageLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_stage_init(&stage1, "StageLogger", stage_buf1, sizeof(stage_buf1));
+	assert( ret == OK );
+	ret = minix_ls_stage_init(&stage2, "StageLogger", stage_buf2, sizeof(stage_buf2));
+	assert( ret == OK );
+
+	for (int i = 0; i < 40; i++) {
+		ret = minix_ls_stage_write(i % 2 ? &stage2 : &stage1, "from a thread", MINIX_LS_LEVEL_INFO);
+		assert( ret == OK ); // Fills up and flushes the stages on the way
+	}
+	ret = minix_ls_stage_write(&stage1, "filtered", MINIX_LS_LEVEL_DEBUG);
+	assert( ret == OK );
+
+	ret = minix_ls_stage_flush(&stage1);
+	assert( ret == OK );
+	ret = minix_ls_stage_flush(&stage2);
+	assert( ret == OK );
+
+	ret = minix_ls_close_log("StageLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_get_stats("StageLogger", &stats);
+	assert( ret == OK );
+	assert( stats.written == 40 );
+	assert( stats.filtered == 1 );
+
+	// Test two loggers writing to the same file
+	ret = minix_ls_start_log("SharedLogger1");
+	assert( ret == OK );
+	ret = minix_ls_start_log("SharedLogger2");
+	assert( ret == OK );
+
+	for (int i = 0; i < 5; i++) {
+		ret = minix_ls_write_log(i % 2 ? "SharedLogger2" : "SharedLogger1", "one file, one stream", MINIX_LS_LEVEL_INFO);
+		assert( ret == OK );
+	}
+
+	ret = minix_ls_close_log("SharedLogger1");
+	assert( ret == OK );
+
+	ret = minix_ls_write_log("SharedLogger2", "still open after the other logger closed", MINIX_LS_LEVEL_INFO);
+	assert( ret == OK );
+
+	ret = minix_ls_close_log("SharedLogger2");
+	assert( ret == OK );
+
+	ret = minix_ls_get_stats("SharedLogger2", &stats);
+	assert( ret == OK );
+	assert( stats.written == 3 );
+
+	// Test that a larger buffer gets the same lines to the file in fewer
+	// write() and fsync() calls
+	minix_ls_stats_t large_stats;
+	ret = minix_ls_start_log("UnbufferedLogger");
+	assert( ret == OK );
+	ret = minix_ls_start_log("LargeBufferLogger");
+	assert( ret == OK );
+
+	for (int i = 0; i < 2000; i++) {
+		ret = minix_ls_write_log("UnbufferedLogger", "a line long enough that a few dozen of them fill up the default buffer of a file", MINIX_LS_LEVEL_INFO);
+		assert( ret == OK );
+		ret = minix_ls_write_log("LargeBufferLogger", "a line long enough that a few dozen of them fill up the default buffer of a file", MINIX_LS_LEVEL_INFO);
+		assert( ret == OK );
+	}
+
+	ret = minix_ls_close_log("UnbufferedLogger");
+	assert( ret == OK );
+	ret = minix_ls_close_log("LargeBufferLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_get_stats("UnbufferedLogger", &stats);
+	assert( ret == OK );
+	ret = minix_ls_get_stats("LargeBufferLogger", &large_stats);
+	assert( ret == OK );
+	assert( stats.written == 2000 && large_stats.written == 2000 );
+	assert( large_stats.writes < stats.writes );
+	assert( large_stats.syncs <= stats.syncs );
+
+	// Test a compressed file; read it back with lsdump /var/log/file.compressed.log
+	ret = minix_ls_start_log("CompressedLogger");
+	assert( ret == OK );
+
+	for (int i = 0; i < 100; i++) {
+		ret = minix_ls_write_log("CompressedLogger", "the same line over and over, which compresses well", MINIX_LS_LEVEL_INFO);
+		assert( ret == OK );
+	}
+
+	ret = minix_ls_close_log("CompressedLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_get_stats("CompressedLogger", &stats);
+	assert( ret == OK );
+	assert( stats.written == 100 );
+
+	// Test an indexed file; lsgrep -s warn /var/log/file.indexed.log should
+	// only read the regions with the two warnings
+	ret = minix_ls_start_log("IndexedLogger");
+	assert( ret == OK );
+
+	for (int i = 0; i < 64; i++) {
+		ret = minix_ls_write_log("IndexedLogger", i % 40 == 5 ? "indexed warning" : "indexed line",
+			i % 40 == 5 ? MINIX_LS_LEVEL_WARN : MINIX_LS_LEVEL_DEBUG);
+		assert( ret == OK );
+	}
+
+	ret = minix_ls_close_log("IndexedLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_get_stats("IndexedLogger", &stats);
+	assert( ret == OK );
+	assert( stats.written == 64 );
+
+	// Test subscriptions; only the two warnings should reach the subscriber
+	static char records[2 * MINIX_LS_MAX_RECORD_LEN];
+	unsigned int dropped;
+	int sub = minix_ls_subscribe("SubscribedLogger", MINIX_LS_LEVEL_WARN);
+	assert( sub >= 0 );
+
+	ret = minix_ls_subscribe("SubscribedLogger", MINIX_LS_LEVEL_INFO);
+	assert( ret == -EINVAL ); // Already subscribed
+
+	ret = minix_ls_start_log("SubscribedLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_write_log("SubscribedLogger", "not for the subscriber", MINIX_LS_LEVEL_INFO);
+	assert( ret == OK );
+	ret = minix_ls_write_log("SubscribedLogger", "first warning", MINIX_LS_LEVEL_WARN);
+	assert( ret == OK );
+	ret = minix_ls_write_log("SubscribedLogger", "second warning", MINIX_LS_LEVEL_WARN);
+	assert( ret == OK );
+
+	int len = minix_ls_read_subscription(sub, records, sizeof(records), &dropped);
+	assert( len > 0 );
+	assert( dropped == 0 );
+
+	int nrecords = 0;
+	for (int off = 0; off < len; nrecords++) {
+		minix_ls_record_t* rec = (minix_ls_record_t*) (records + off);
+		assert( rec->severity == MINIX_LS_LEVEL_WARN );
+		off += MINIX_LS_RECORD_SIZE(rec->len);
+	}
+	assert( nrecords == 2 );
+
+	ret = minix_ls_close_log("SubscribedLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_unsubscribe(sub);
+	assert( ret == OK );
+
+	ret = minix_ls_read_subscription(sub, records, sizeof(records), &dropped);
+	assert( ret == LS_ERR_NO_SUCH_SUBSCRIPTION );
+
+	// Test that a buffer reused for another format is not sent with the id
+	// of the first, and that a NUL from %c does not cut the line short
+	const char* expected[] = { "number 7\n", "string seven\n", "char \\0.\n" };
+	char reused[32];
+	sub = minix_ls_subscribe("SubscribedLogger", MINIX_LS_LEVEL_INFO);
+	assert( sub >= 0 );
+
+	ret = minix_ls_start_log("SubscribedLogger");
+	assert( ret == OK );
+
+	strcpy(reused, "number %d");
+	ret = minix_ls_writef("SubscribedLogger", MINIX_LS_LEVEL_INFO, reused, 7);
+	assert( ret == OK );
+	strcpy(reused, "string %s");
+	ret = minix_ls_writef("SubscribedLogger", MINIX_LS_LEVEL_INFO, reused, "seven");
+	assert( ret == OK );
+	ret = minix_ls_writef("SubscribedLogger", MINIX_LS_LEVEL_INFO, "char %c.", 0);
+	assert( ret == OK );
+
+	len = minix_ls_read_subscription(sub, records, sizeof(records), &dropped);
+	assert( len > 0 );
+
+	nrecords = 0;
+	for (int off = 0; off < len; nrecords++) {
+		minix_ls_record_t* rec = (minix_ls_record_t*) (records + off);
+		assert( nrecords < 3 && rec->len >= strlen(expected[nrecords]) );
+		assert( memcmp((char*) (rec + 1) + rec->len - strlen(expected[nrecords]),
+			expected[nrecords], strlen(expected[nrecords])) == 0 );
+		off += MINIX_LS_RECORD_SIZE(rec->len);
+	}
+	assert( nrecords == 3 );
+
+	ret = minix_ls_close_log("SubscribedLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_unsubscribe(sub);
+	assert( ret == OK );
+
+	// Test that a write flagged LS_WRITE_GRANT is read through its grant, as
+	// ls_write_grant in libsys sends it, and not from the message address;
+	// a user process has no grants, so ls has nothing to copy from
+	static char grant_line[] = "through a grant";
+	message m;
+	memset(&m, 0, sizeof(m));
+	strncpy(m.m_ls_start_log.logger, "GrantLogger", LS_IPC_LOGGER_MAX_NAME_LEN);
+	ret = _syscall(LS_PROC_NR, LS_START_LOG, &m);
+	assert( ret == OK );
+	int handle = m.m_ls_start_log_reply.handle;
+
+	for (int flags = LS_WRITE_GRANT; flags >= 0; flags -= LS_WRITE_GRANT) {
+		memset(&m, 0, sizeof(m));
+		m.m_ls_write.handle = handle;
+		m.m_ls_write.severity = MINIX_LS_LEVEL_INFO;
+		m.m_ls_write.message = grant_line;
+		m.m_ls_write.message_len = strlen(grant_line);
+		m.m_ls_write.flags = flags;
+		m.m_ls_write.grant = 0;
+		ret = _syscall(LS_PROC_NR, LS_WRITE, &m);
+		assert( flags ? ret != OK : ret == OK );
+	}
+
+	ret = minix_ls_close_log("GrantLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_get_stats("GrantLogger", &stats);
+	assert( ret == OK );
+	assert( stats.written == 1 ); // Only the write without the flag
+
+	// Test that a stage whose handle went stale writes by name; this
+	// initializes ls again, so it has to come last
+	ret = minix_ls_start_log("StageLogger");
+	assert( ret == OK );
+	ret = minix_ls_stage_init(&stage1, "StageLogger", stage_buf1, sizeof(stage_buf1));
+	assert( ret == OK );
+	ret = minix_ls_stage_write(&stage1, "staged before initializing", MINIX_LS_LEVEL_INFO);
+	assert( ret == OK );
+
+	ret = minix_ls_initialize();
+	assert( ret == OK );
+	ret = minix_ls_start_log("StageLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_stage_flush(&stage1);
+	assert( ret == OK );
+
+	ret = minix_ls_close_log("StageLogger");
+	assert( ret == OK );
+
+	ret = minix_ls_get_stats("StageLogger", &stats);
+	assert( ret == OK );
+	assert( stats.written == 1 );
+
 	printf("It appears that tests are passing. Have fun!\n");
 	return 0;
 }
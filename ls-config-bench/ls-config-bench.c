@@ -0,0 +1,105 @@
+#include <minix/ls.h>
+#include <minix/com.h>
+#include <sys/errno.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OK 0
+
+#define CONFIG_PATH         "/etc/logs.conf"
+#define BACKUP_PATH         "/etc/logs.conf.bench-orig"
+
+/* Measures how long ls takes to (re)parse a generated configuration file.
+ * The existing /etc/logs.conf is moved aside while the benchmark runs and put
+ * back afterwards, so this needs to run as root.
+ *
+ * Usage: ls-config-bench [nloggers] [rounds]
+ */
+
+int write_config(int nloggers) {
+	FILE* f = fopen(CONFIG_PATH, "w");
+	if (!f) {
+		printf("Cannot open %s for writing\n", CONFIG_PATH);
+		return -1;
+	}
+
+	for (int i = 0; i < nloggers; i++) {
+		fprintf(f,
+			"logger BenchLogger%d {\n"
+			"\tdestination = file\n"
+			"\tfilename = /var/log/bench.%d.log\n"
+			"\tappend = true\n"
+			"\tseverity = info\n"
+			"\tformat = [BenchLogger%d %%t] %%n (%%l) %%m\n"
+			"}\n\n", i, i, i);
+	}
+
+	fclose(f);
+	return 0;
+}
+
+long elapsed_us(struct timeval* start, struct timeval* end) {
+	return (end->tv_sec - start->tv_sec) * 1000000L + (end->tv_usec - start->tv_usec);
+}
+
+int main(int argc, char** argv) {
+	int nloggers = argc > 1 ? atoi(argv[1]) : 10000;
+	int rounds = argc > 2 ? atoi(argv[2]) : 10;
+	int ret = OK;
+
+	if (nloggers <= 0 || rounds <= 0) {
+		printf("Usage: %s [nloggers] [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	if (rename(CONFIG_PATH, BACKUP_PATH) != 0) {
+		printf("Cannot move %s out of the way\n", CONFIG_PATH);
+		return 1;
+	}
+
+	if (write_config(nloggers) != 0) {
+		ret = -1;
+		goto restore;
+	}
+
+	long total_us = 0, best_us = -1;
+	for (int i = 0; i < rounds; i++) {
+		struct timeval start, end;
+
+		gettimeofday(&start, NULL);
+		ret = minix_ls_initialize();
+		gettimeofday(&end, NULL);
+
+		if (ret != OK) {
+			printf("minix_ls_initialize failed: %d\n", ret);
+			goto restore;
+		}
+
+		long us = elapsed_us(&start, &end);
+		total_us += us;
+		if (best_us < 0 || us < best_us) {
+			best_us = us;
+		}
+	}
+
+	printf("%d loggers, %d rounds\n", nloggers, rounds);
+	printf("  average: %ld us per parse, %ld us per 10k loggers\n",
+		total_us / rounds, (long)((total_us / rounds) * (10000.0 / nloggers)));
+	printf("  best:    %ld us per parse, %ld us per 10k loggers\n",
+		best_us, (long)(best_us * (10000.0 / nloggers)));
+
+restore:
+	unlink(CONFIG_PATH);
+	if (rename(BACKUP_PATH, CONFIG_PATH) != 0) {
+		printf("Failed to restore %s from %s\n", CONFIG_PATH, BACKUP_PATH);
+		return 1;
+	}
+
+	/* Put the original loggers back in place. */
+	minix_ls_initialize();
+
+	return ret == OK ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "lz.h"
+
+/* Prints the log text of a file written by an ls sink with compress = lz.
+ * With -l, the blocks of the file are listed instead: their number, offset,
+ * and length before and after compression. With -b, only the given block is
+ * printed; the blocks before it are skipped by their headers, without being
+ * read or decompressed. */
+
+char g_stored[LS_LZ_BLOCK_SIZE];
+char g_raw[LS_LZ_BLOCK_SIZE];
+
+void usage() {
+	fprintf(stderr, "usage: lsdump [-l] [-b block] file\n");
+	exit(1);
+}
+
+/* Returns 1 if there is another block, 0 at the end of the file, and -1 if
+ * what follows is not a block. */
+int read_header(int fd, ls_lz_header_t* hdr) {
+	int n = read(fd, hdr, sizeof(*hdr));
+	if (n == 0) {
+		return 0;
+	}
+
+	if (n != sizeof(*hdr) || hdr->magic != LS_LZ_MAGIC ||
+			hdr->raw_len > LS_LZ_BLOCK_SIZE || hdr->stored_len > LS_LZ_BLOCK_SIZE) {
+		return -1;
+	}
+
+	return 1;
+}
+
+int dump_block(int fd, const ls_lz_header_t* hdr, long n) {
+	const char* text = g_stored;
+	int len = hdr->stored_len;
+
+	if (read(fd, g_stored, len) != len) {
+		fprintf(stderr, "lsdump: block %ld is cut short\n", n);
+		return -1;
+	}
+
+	if (!(hdr->flags & LS_LZ_STORED)) {
+		len = lz_decompress(g_stored, len, g_raw, sizeof(g_raw));
+		if (len != (int) hdr->raw_len) {
+			fprintf(stderr, "lsdump: block %ld is corrupt\n", n);
+			return -1;
+		}
+		text = g_raw;
+	}
+
+	fwrite(text, 1, len, stdout);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	ls_lz_header_t hdr;
+	int list = 0;
+	long only = -1;
+	long n;
+	int ret;
+	char* end;
+	int c;
+
+	while ((c = getopt(argc, argv, "lb:")) != -1) {
+		switch (c) {
+		case 'l':
+			list = 1;
+			break;
+		case 'b':
+			only = strtol(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0' || only < 0) {
+				usage();
+			}
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage();
+	}
+
+	const char* path = argv[optind];
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+
+	off_t off = 0;
+	for (n = 0; (ret = read_header(fd, &hdr)) > 0; n++) {
+		if (list) {
+			printf("%ld\t%lld\t%u\t%u\n", n, (long long) off, hdr.raw_len, hdr.stored_len);
+		}
+
+		if (list || (only >= 0 && n != only)) {
+			if (lseek(fd, hdr.stored_len, SEEK_CUR) < 0) {
+				perror(path);
+				return 1;
+			}
+		} else if (dump_block(fd, &hdr, n) != 0) {
+			return 1;
+		}
+
+		off += sizeof(hdr) + hdr.stored_len;
+		if (n == only) {
+			break;
+		}
+	}
+
+	if (ret < 0) {
+		fprintf(stderr, "lsdump: %s: no block at offset %lld\n", path, (long long) off);
+		return 1;
+	}
+
+	if (only >= 0 && n != only) {
+		fprintf(stderr, "lsdump: %s has only %ld blocks\n", path, n);
+		return 1;
+	}
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "index.h"
+
+/* Prints the lines of a log file written by an ls sink with the index option
+ * that contain a pattern, looking only at the regions of the file which,
+ * going by its index, have lines of at least the given severity from the
+ * given time span. The index only knows about regions, so other lines of a
+ * matching region are printed too; the pattern can narrow them down. Lines
+ * written after the last complete region are not in the index yet, and are
+ * searched unless the span has an end. */
+
+const char* g_severities[] = { "trace", "debug", "info", "warn" };
+
+void usage() {
+	fprintf(stderr, "usage: lsgrep [-s severity] [-f from] [-t to] [pattern] file\n");
+	fprintf(stderr, "       times are seconds since the epoch or 'YYYY-MM-DD hh:mm[:ss]'\n");
+	exit(1);
+}
+
+int parse_severity(const char* s) {
+	for (int i = 0; i < 4; i++) {
+		if (strcmp(s, g_severities[i]) == 0) {
+			return i;
+		}
+	}
+
+	usage();
+	return -1;
+}
+
+time_t parse_time(const char* s) {
+	struct tm tm;
+	char* end;
+
+	long t = strtol(s, &end, 10);
+	if (*s != '\0' && *end == '\0') {
+		return t;
+	}
+
+	memset(&tm, 0, sizeof(tm));
+	if (sscanf(s, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+			&tm.tm_hour, &tm.tm_min, &tm.tm_sec) < 5) {
+		usage();
+	}
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	tm.tm_isdst = -1;
+
+	return mktime(&tm);
+}
+
+/* Prints the lines among the next len bytes of the file that contain the
+ * pattern. A negative len searches up to the end of the file. */
+void search(FILE* log, off_t offset, long len, const char* pattern) {
+	char* line = NULL;
+	size_t cap = 0;
+	ssize_t n;
+
+	if (fseeko(log, offset, SEEK_SET) != 0) {
+		return;
+	}
+
+	while ((len < 0 || len > 0) && (n = getline(&line, &cap, log)) > 0) {
+		if (!pattern || strstr(line, pattern)) {
+			fwrite(line, 1, n, stdout);
+		}
+		if (len > 0) {
+			len = n < len ? len - n : 0;
+		}
+	}
+
+	free(line);
+}
+
+int main(int argc, char** argv) {
+	ls_index_entry_t e;
+	int min_severity = 0;
+	time_t from = 0;
+	time_t to = 0;
+	int has_to = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "s:f:t:")) != -1) {
+		switch (c) {
+		case 's':
+			min_severity = parse_severity(optarg);
+			break;
+		case 'f':
+			from = parse_time(optarg);
+			break;
+		case 't':
+			to = parse_time(optarg);
+			has_to = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind != argc - 1 && optind != argc - 2) {
+		usage();
+	}
+
+	const char* pattern = optind == argc - 2 ? argv[optind] : NULL;
+	const char* path = argv[argc - 1];
+	char index_path[FILENAME_MAX];
+	snprintf(index_path, sizeof(index_path), "%s" LS_INDEX_SUFFIX, path);
+
+	FILE* log = fopen(path, "r");
+	if (!log) {
+		perror(path);
+		return 1;
+	}
+
+	FILE* index = fopen(index_path, "r");
+	if (!index) {
+		perror(index_path);
+		return 1;
+	}
+
+	uint32_t severities = ~((1u << min_severity) - 1);
+	off_t indexed = 0;
+
+	while (fread(&e, sizeof(e), 1, index) == 1) {
+		if (e.offset + e.length > (uint64_t) indexed) {
+			indexed = e.offset + e.length;
+		}
+
+		if (!(e.severities & severities) || (time_t) e.max_time < from ||
+				(has_to && (time_t) e.min_time > to)) {
+			continue;
+		}
+
+		search(log, e.offset, e.length, pattern);
+	}
+
+	if (!has_to) {
+		search(log, indexed, -1, pattern);
+	}
+
+	fclose(index);
+	fclose(log);
+	return 0;
+}
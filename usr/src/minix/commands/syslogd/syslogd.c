@@ -94,6 +94,7 @@
 #include <time.h>
 #include <sys/ioctl.h>
 #include <sys/select.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/wait.h>
@@ -103,6 +104,7 @@
 #include <net/gen/udp.h>
 #include <net/gen/udp_io.h>
 #include <netdb.h>
+#include <minix/ls.h>
 
 #define SYSLOG_NAMES
 #include <syslog.h>
@@ -198,7 +200,7 @@ static const char *PidFile = PIDFILE;	/* "/var/run/syslogd.pid" */
 static const char ctty[] = CTTY;
 
 static const char ProgName[] = "syslogd:";
-static const char version[] = "1.3 (Minix)";
+static const char version[] = "1.4 (Minix)";
 static const char usage[] =
  /* */ "usage:\tsyslogd [-d] [-m markinterval] [-f conf-file]\n"
        "\t\t[-p listeningport] [-v] [-?]\n" ;
@@ -805,6 +807,73 @@ int sockread(int *fd, char *buf, int maxlen)
 	return len;
 }
 
+/*
+**  Name:	int lsopen(int *wfd);
+**  Function:	Creates and opens the FIFO the logging server (ls)
+**		forwards its records through.  A write end is kept
+**		open as well, so that the FIFO does not read as EOF
+**		while ls has it closed.
+*/
+int lsopen(int *wfd)
+{
+  int fd;
+
+  unlink(MINIX_LS_SYSLOG_PATH);
+  if (mkfifo(MINIX_LS_SYSLOG_PATH, 0600) < 0) {
+	logerror("mkfifo for ls failed");
+	return -1;
+  }
+  if ((fd = open(MINIX_LS_SYSLOG_PATH, O_RDONLY | O_NONBLOCK)) < 0) {
+	logerror("open fifo for ls failed");
+	return -1;
+  }
+  *wfd = open(MINIX_LS_SYSLOG_PATH, O_WRONLY | O_NONBLOCK);
+  return fd;
+}
+
+/*
+**  Name:	void lsread(int *fd);
+**  Function:	Reads a batch of records from ls.  Every record is
+**		a "<pri>message" line, and a read may end in the
+**		middle of one, so the tail is kept for the next read.
+*/
+void lsread(int *fd)
+{
+  static char buf[2 * MAXLINE + 2];
+  static int have = 0;
+  char *p, *eol;
+  int len;
+
+  len = read(*fd, buf + have, sizeof(buf) - have - 1);
+  if (len < 0) {
+	if (errno != EINTR && errno != EAGAIN) {
+		logerror("Receive error from ls channel");
+		close(*fd);
+		*fd = -1;
+	}
+	return;
+  }
+  dprintf("got ls records (%d, %#x)\n", *fd, len);
+
+  have += len;
+  buf[have] = '\0';
+  p = buf;
+  while ((eol = strchr(p, '\n'))) {
+	*eol = '\0';
+	printline(LocalHostName, p);
+	p = eol + 1;
+  }
+
+  have -= p - buf;
+  if (have == sizeof(buf) - 1) {
+	/* A record longer than the buffer; log what we have of it */
+	printline(LocalHostName, buf);
+	have = 0;
+  } else {
+	memmove(buf, p, have);
+  }
+}
+
 /*
 **  Name:	int main(int argc, char **argv);
 **  Function:	Syslog daemon entry point
@@ -813,7 +882,7 @@ int main(int argc, char **argv)
 {
   char *p, *udpdev, *eol;
   int nfd, kfd, len, fdmax;
-  int ufd;
+  int ufd, lfd, lwfd = -1;
   int ch, port = 0;
   fd_set fdset;
   struct nwio_udpopt udpopt;
@@ -915,7 +984,10 @@ int main(int argc, char **argv)
 
   DEBUG(dprintf("unix domain socket = %d, at %s....\n", ufd, _PATH_LOG);)
 
-  fdmax = max(max(nfd, kfd), ufd) + 1;
+  /* Open the FIFO ls forwards batches of records through */
+  lfd = lsopen(&lwfd);
+
+  fdmax = max(max(max(nfd, kfd), ufd), lfd) + 1;
 
   DEBUG(dprintf("off & running....\n");)
   
@@ -927,6 +999,7 @@ int main(int argc, char **argv)
 	if(nfd >= 0) FD_SET(nfd, &fdset);
 	if(kfd >= 0) FD_SET(kfd, &fdset);
 	if(ufd >= 0) FD_SET(ufd, &fdset);
+	if(lfd >= 0) FD_SET(lfd, &fdset);
 
 	dprintf("select: nfd = %d, ufd = %d, fdmax = %d\n", nfd, ufd, fdmax);
 
@@ -946,6 +1019,11 @@ int main(int argc, char **argv)
 		len = sockread(&ufd, line, MAXLINE);
 	}
 
+	if (lfd >= 0 && FD_ISSET(lfd, &fdset)) {
+		dprintf("got lfd message (%d)\n", lfd);
+		lsread(&lfd);
+	}
+
 	if (kfd >= 0 && FD_ISSET(kfd, &fdset)) {
 		static char linebuf[5*1024];
 
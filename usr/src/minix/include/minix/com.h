@@ -976,7 +976,15 @@
 #define LS_CLOSE_LOG    (LS_BASE + 5)
 #define LS_CLEAR_LOG    (LS_BASE + 6)
 #define LS_CLEAR_ALL    (LS_BASE + 7)
-#define LS_END          (LS_BASE + 8)
+#define LS_CREATE_LOGGER (LS_BASE + 8)
+#define LS_GET_STATS    (LS_BASE + 9)
+#define LS_WRITE        (LS_BASE + 10)
+#define LS_REGISTER_FORMAT (LS_BASE + 11)
+#define LS_WRITE_BATCH  (LS_BASE + 12)
+#define LS_SUBSCRIBE    (LS_BASE + 13)
+#define LS_READ_SUBSCRIPTION (LS_BASE + 14)
+#define LS_UNSUBSCRIBE  (LS_BASE + 15)
+#define LS_END          (LS_BASE + 16)
 
 #define LS_ERR_BASE              -5888
 #define LS_ERR_NO_SUCH_LOGGER    (LS_ERR_BASE - 1)
@@ -985,7 +993,12 @@
 #define LS_ERR_LOGGER_NOT_OPEN   (LS_ERR_BASE - 4)
 #define LS_ERR_INIT_FAILED       (LS_ERR_BASE - 5)
 #define LS_ERR_EXTERNAL          (LS_ERR_BASE - 6)
-#define LS_ERR_END               (LS_ERR_BASE - 7)
+#define LS_ERR_NO_SUCH_TEMPLATE  (LS_ERR_BASE - 7)
+#define LS_ERR_LOGGER_EXISTS     (LS_ERR_BASE - 8)
+#define LS_ERR_LIMIT_REACHED     (LS_ERR_BASE - 9)
+#define LS_ERR_NO_SUCH_FORMAT    (LS_ERR_BASE - 10)
+#define LS_ERR_NO_SUCH_SUBSCRIPTION (LS_ERR_BASE - 11)
+#define LS_ERR_END               (LS_ERR_BASE - 12)
 
 /*===========================================================================*
  *		Internal codes used by several services			     *
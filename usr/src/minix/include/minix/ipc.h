@@ -2048,8 +2048,144 @@ typedef struct {
 } mess_ls_write_log;
 _ASSERT_MSG_SIZE(mess_ls_write_log);
 
+typedef struct {
+	char logger[LS_IPC_LOGGER_MAX_NAME_LEN];
+	void* spec;
+	uint16_t template_len;
+	uint16_t overrides_len;
+} mess_ls_create_logger;
+_ASSERT_MSG_SIZE(mess_ls_create_logger);
+
+typedef struct {
+	char logger[LS_IPC_LOGGER_MAX_NAME_LEN];
+	void* stats;
+	char padding[4];
+} mess_ls_get_stats;
+_ASSERT_MSG_SIZE(mess_ls_get_stats);
+
+/* Reply to LS_START_LOG. The handle can be used with LS_WRITE instead of the
+ * logger name. The rest lets the client filter and sample lines without
+ * asking ls. */
+typedef struct {
+	int32_t handle;
+	uint32_t tsc_khz;
+	uint16_t severity;
+	uint16_t sample_every[4];
+	uint8_t padding[38];
+} mess_ls_start_log_reply;
+_ASSERT_MSG_SIZE(mess_ls_start_log_reply);
+
+/* tsc is the client's TSC when the line was logged; ls uses it as the time
+ * of the event. It comes first to keep it aligned. If format_id is not 0, the
+ * message holds the arguments for a format registered with
+ * LS_REGISTER_FORMAT rather than text. If flags has LS_WRITE_GRANT set, the
+ * message is read through grant rather than from the message address; only
+ * system processes, which have a grant table, can do that (see
+ * ls_write_grant in libsys). */
+typedef struct {
+	uint64_t tsc;
+	int32_t handle;
+	uint16_t severity;
+	uint16_t message_len;
+	void* message;
+	uint32_t filtered;
+	uint32_t sampled;
+	uint16_t format_id;
+	uint16_t flags;
+	cp_grant_id_t grant;
+	uint8_t padding[20];
+} mess_ls_write;
+_ASSERT_MSG_SIZE(mess_ls_write);
+
+#define LS_WRITE_GRANT 0x1
+
+/* Lines buffered by a client, sent with one LS_WRITE_BATCH. Each line is an
+ * ls_batch_line_t followed by message_len bytes of message, as in LS_WRITE,
+ * padded to LS_BATCH_ALIGN. The batch can be passed by grant, as for
+ * LS_WRITE. */
+typedef struct {
+	int32_t handle;
+	void* batch;
+	uint32_t batch_len;
+	uint32_t filtered;
+	uint32_t sampled;
+	cp_grant_id_t grant;
+	uint16_t flags;
+	uint8_t padding[30];
+} mess_ls_write_batch;
+_ASSERT_MSG_SIZE(mess_ls_write_batch);
+
+typedef struct {
+	uint64_t tsc;
+	uint16_t severity;
+	uint16_t format_id;
+	uint16_t message_len;
+	uint16_t padding;
+} ls_batch_line_t;
+
+#define LS_BATCH_ALIGN(len) (((len) + 7) & ~7)
+
+typedef struct {
+	void* format;
+	uint16_t format_len;
+	uint8_t padding[50];
+} mess_ls_register_format;
+_ASSERT_MSG_SIZE(mess_ls_register_format);
+
+typedef struct {
+	int32_t format_id;
+	uint8_t padding[52];
+} mess_ls_register_format_reply;
+_ASSERT_MSG_SIZE(mess_ls_register_format_reply);
+
+typedef struct {
+	char logger[LS_IPC_LOGGER_MAX_NAME_LEN];
+	uint32_t filtered;
+	uint32_t sampled;
+} mess_ls_close_log;
+_ASSERT_MSG_SIZE(mess_ls_close_log);
+
+typedef struct {
+	char logger[LS_IPC_LOGGER_MAX_NAME_LEN];
+	uint16_t severity;
+	char padding[6];
+} mess_ls_subscribe;
+_ASSERT_MSG_SIZE(mess_ls_subscribe);
+
+typedef struct {
+	int32_t subscription;
+	uint8_t padding[52];
+} mess_ls_subscribe_reply;
+_ASSERT_MSG_SIZE(mess_ls_subscribe_reply);
+
+/* Records are copied to buf, or through grant if flags has LS_READ_GRANT
+ * set; as with LS_WRITE, only system processes can pass a grant. */
+typedef struct {
+	int32_t subscription;
+	void* buf;
+	uint32_t buf_len;
+	cp_grant_id_t grant;
+	uint16_t flags;
+	uint8_t padding[38];
+} mess_ls_read_subscription;
+_ASSERT_MSG_SIZE(mess_ls_read_subscription);
+
+#define LS_READ_GRANT 0x1
+
+typedef struct {
+	uint32_t len;
+	uint32_t dropped;
+	uint8_t padding[48];
+} mess_ls_read_subscription_reply;
+_ASSERT_MSG_SIZE(mess_ls_read_subscription_reply);
+
+typedef struct {
+	int32_t subscription;
+	uint8_t padding[52];
+} mess_ls_unsubscribe;
+_ASSERT_MSG_SIZE(mess_ls_unsubscribe);
+
 typedef mess_ls_logger mess_ls_start_log;
-typedef mess_ls_logger mess_ls_close_log;
 typedef mess_ls_logger mess_ls_clear_log;
 
 typedef struct {
@@ -2286,6 +2422,18 @@ typedef struct {
 		mess_ls_write_log m_ls_write_log;
 		mess_ls_close_log m_ls_close_log;
 		mess_ls_clear_log m_ls_clear_log;
+		mess_ls_create_logger m_ls_create_logger;
+		mess_ls_get_stats m_ls_get_stats;
+		mess_ls_start_log_reply m_ls_start_log_reply;
+		mess_ls_write m_ls_write;
+		mess_ls_register_format m_ls_register_format;
+		mess_ls_write_batch m_ls_write_batch;
+		mess_ls_register_format_reply m_ls_register_format_reply;
+		mess_ls_subscribe m_ls_subscribe;
+		mess_ls_subscribe_reply m_ls_subscribe_reply;
+		mess_ls_read_subscription m_ls_read_subscription;
+		mess_ls_read_subscription_reply m_ls_read_subscription_reply;
+		mess_ls_unsubscribe m_ls_unsubscribe;
 
 		u8_t size[56];	/* message payload may have 56 bytes at most */
 	};
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
 /* Possible levels for log messages. */
 #define MINIX_LS_LEVEL_TRACE              0
 #define MINIX_LS_LEVEL_DEBUG              1
@@ -8,6 +11,85 @@
 
 typedef int minix_ls_log_level_t;
 
+/* FIFO through which ls forwards lines of `destination = syslog` loggers to
+ * syslogd. */
+#define MINIX_LS_SYSLOG_PATH              "/var/run/lslog"
+
+/* Largest buffer minix_ls_start_log_buffered will use. */
+#define MINIX_LS_MAX_BATCH_LEN            (16 * 1024)
+
+/* Per-logger counters, as returned by minix_ls_get_stats. They are kept from
+ * the moment ls reads its configuration, across opening and closing of the
+ * logger. */
+typedef struct minix_ls_stats_t {
+	unsigned int written;       /* Lines written to the destination. */
+	unsigned int filtered;      /* Lines below the logger's severity. */
+	unsigned int suppressed;    /* Lines dropped by rate limiting. */
+	unsigned int folded;        /* Repeated lines folded by dedup. */
+	unsigned int sampled;       /* Lines dropped by sampling. */
+	unsigned int shed;          /* Lines shed while ls was behind. */
+	unsigned int dropped;       /* Lines dropped by the overflow policy. */
+	unsigned int blocked;       /* Writes held back by overflow = block. */
+	unsigned int writes;        /* write() calls on the logger's files. */
+	unsigned int syncs;         /* fsync() calls on the logger's files. */
+} minix_ls_stats_t;
+
+/* Longest line handed to subscribers, and the smallest buffer that
+ * minix_ls_read_subscription accepts. */
+#define MINIX_LS_MAX_LINE_LEN             4096
+#define MINIX_LS_MAX_RECORD_LEN           MINIX_LS_RECORD_SIZE(MINIX_LS_MAX_LINE_LEN)
+
+/* One line read by minix_ls_read_subscription. The record is followed by len
+ * bytes of the line, formatted as for the first of the logger's destinations
+ * that takes it, and the next record starts MINIX_LS_RECORD_SIZE(len) bytes after this one. */
+typedef struct minix_ls_record_t {
+	unsigned short severity;
+	unsigned short len;
+} minix_ls_record_t;
+
+#define MINIX_LS_RECORD_SIZE(len) \
+	((sizeof(minix_ls_record_t) + (len) + 3) & ~3)
+
+/* Types of the fields of a structured log line. */
+#define MINIX_LS_FIELD_INT                0 /* Signed decimal. */
+#define MINIX_LS_FIELD_STRING             1 /* Quoted if it has to be. */
+#define MINIX_LS_FIELD_HEX                2 /* Unsigned, 0x-prefixed. */
+#define MINIX_LS_FIELD_ENDPOINT           3 /* Process name and endpoint. */
+
+#define MINIX_LS_MAX_FIELD_KEY_LEN        32
+
+/* One key/value field of a line written by minix_ls_write_kv. */
+typedef struct minix_ls_field_t {
+	const char* key;
+	int type;
+	union {
+		long long i;
+		unsigned long long u;
+		const char* s;
+		int endpoint;
+	} value;
+} minix_ls_field_t;
+
+#define MINIX_LS_INT(k, v)      { (k), MINIX_LS_FIELD_INT, { .i = (v) } }
+#define MINIX_LS_STRING(k, v)   { (k), MINIX_LS_FIELD_STRING, { .s = (v) } }
+#define MINIX_LS_HEX(k, v)      { (k), MINIX_LS_FIELD_HEX, { .u = (v) } }
+#define MINIX_LS_ENDPOINT(k, v) { (k), MINIX_LS_FIELD_ENDPOINT, { .endpoint = (v) } }
+
+/* A staging buffer of one thread for a logger, see minix_ls_stage_init. The
+ * fields are private to the client library. */
+typedef struct minix_ls_stage_t {
+	char logger[48];
+	int handle;
+	int severity;
+	unsigned int sample_every[4];
+	unsigned int sample_state;
+	unsigned int filtered;
+	unsigned int sampled;
+	char* buf;
+	size_t buf_size;
+	size_t buf_len;
+} minix_ls_stage_t;
+
 /*
  * Explicitly initializes the logging server. This includes parsing of the
  * configuration file. If not called explicitly, this initialization will be done
@@ -28,6 +110,10 @@ int minix_ls_initialize(void);
  * required before writing to the log. The severity of the log is set to the
  * default severity as defined in the configuration file.
  *
+ * The logger's severity and sampling rates are remembered by the calling
+ * process, so that lines which would be filtered or sampled away by
+ * minix_ls_write_log are dropped before they are ever sent to ls.
+ *
  * Params:
  *     logger:                A null-terminated string containing the logger name.
  *
@@ -47,6 +133,114 @@ int minix_ls_initialize(void);
  */
 int minix_ls_start_log(const char* logger);
 
+/*
+ * Starts a given logger, like minix_ls_start_log, but has the calling process
+ * collect the lines it writes to the logger in a buffer, and hand them to ls in
+ * one IPC. The buffer is flushed when it fills up, by the first write to any
+ * logger after flush_ms milliseconds have passed since the oldest line in it
+ * was written, by minix_ls_flush and minix_ls_close_log, and when the process
+ * exits through exit(). Lines keep the time they were written at, not the time
+ * they were flushed.
+ *
+ * There is no timer behind flush_ms: a process that stops writing keeps its
+ * lines in the buffer until it writes again, flushes, or exits. A process that
+ * may be idle for long should call minix_ls_flush when it goes idle.
+ *
+ * Errors that ls reports for buffered lines are returned by the call that
+ * flushes them. If ls no longer knows the format of a line buffered by
+ * minix_ls_writef, e.g. because it has been restarted, the line is formatted
+ * by the process and sent again. If the process dies without calling exit(),
+ * buffered lines are lost.
+ *
+ * Params:
+ *     logger:                A null-terminated string containing the logger name.
+ *     bufsize:               Size of the buffer, in bytes. Values above
+ *                            MINIX_LS_MAX_BATCH_LEN are treated as
+ *                            MINIX_LS_MAX_BATCH_LEN.
+ *     flush_ms:              How long a line can sit in the buffer before the
+ *                            next write flushes it. 0 means the buffer is only
+ *                            flushed when it is full, or explicitly.
+ *
+ * Return values:
+ *     The same as for minix_ls_start_log. EINVAL is also returned if bufsize
+ *     is too small to be useful, and ENOMEM if the buffer cannot be allocated,
+ *     in which case the logger is left open but unbuffered.
+ */
+int minix_ls_start_log_buffered(const char* logger, size_t bufsize,
+		unsigned int flush_ms);
+
+/*
+ * Hands any lines buffered for the logger to ls right away. Does nothing for
+ * loggers that are not buffered.
+ *
+ * Params:
+ *     logger:                A null-terminated string containing the logger name.
+ *
+ * Return values:
+ *     OK, or the first error ls reported for one of the lines.
+ */
+int minix_ls_flush(const char* logger);
+
+/*
+ * Sets up a staging buffer through which one thread of a multithreaded
+ * process can write to a logger the process has started. Lines written with
+ * minix_ls_stage_write go into the thread's own buffer, and are handed to ls
+ * in one IPC when it fills up or on minix_ls_stage_flush, in the order the
+ * thread wrote them. Nothing is shared between stages, so threads writing
+ * through their own stages never have to wait for each other; a thread would
+ * usually keep its stage in thread-specific data. Lines of different threads
+ * are interleaved in the log as their batches reach ls, and each keeps the
+ * time it was written at.
+ *
+ * A stage holds a copy of the logger's settings from when it was set up, and
+ * writing or flushing it uses nothing else of the library's state, so stages
+ * can be used concurrently with each other and with the process's other
+ * calls. Setting a stage up reads the loggers the process has started, so it
+ * must not run concurrently with minix_ls_start_log, minix_ls_close_log or
+ * minix_ls_initialize. If the logger is started again, or minix_ls_initialize
+ * is called, the stage's lines are written by the logger's name instead, one
+ * IPC per line, until the stage is set up again. A stage must not be used by
+ * more than one thread at a time.
+ *
+ * Params:
+ *     stage:                 The stage to set up.
+ *     logger:                A null-terminated string containing the logger
+ *                            name. The logger has to have been started by this
+ *                            process with minix_ls_start_log.
+ *     buf:                   Memory for the buffer, owned by the caller until
+ *                            the stage is no longer used.
+ *     bufsize:               Size of buf, in bytes, at most
+ *                            MINIX_LS_MAX_BATCH_LEN.
+ *
+ * Return values:
+ *     LS_ERR_LOGGER_NOT_OPEN: The process has not started this logger.
+ *     EINVAL:                 The logger name is too long, or bufsize is too
+ *                             small or too large.
+ */
+int minix_ls_stage_init(minix_ls_stage_t* stage, const char* logger,
+		void* buf, size_t bufsize);
+
+/*
+ * Writes a line through a staging buffer. The line is dropped right away if
+ * the logger would not keep it.
+ *
+ * Return values:
+ *     OK, or if the buffer had to be flushed to make room, what
+ *     minix_ls_stage_flush returned. EINVAL if the message is too long or the
+ *     level is invalid.
+ */
+int minix_ls_stage_write(minix_ls_stage_t* stage, const char* message,
+		minix_ls_log_level_t level);
+
+/*
+ * Hands the lines in a staging buffer to ls.
+ *
+ * Return values:
+ *     OK, or the first error ls reported for one of the lines. The lines are
+ *     gone from the buffer either way.
+ */
+int minix_ls_stage_flush(minix_ls_stage_t* stage);
+
 /*
  * Closes a given logger. Can only be called by the process that last
  * successfully called minix_ls_start_log on tis logger.
@@ -107,6 +301,10 @@ int minix_ls_set_logger_level(const char* logger, minix_ls_log_level_t
  * Writes a message to the log. The logger must be open by te calling process in
  * order for this call to succeed.
  *
+ * If the logger was started by the calling process, the message is stamped
+ * with the processor's timestamp counter before it is sent, and the %T and %e
+ * fields show that time rather than the time ls got around to the message.
+ *
  * Params:
  *     logger:                   A null-terminated string containing the logger
  *                               name.
@@ -119,7 +317,9 @@ int minix_ls_set_logger_level(const char* logger, minix_ls_log_level_t
  *                               MINIX_LS_LEVEL_* constants. If the level is
  *                               lower in severity than the current severity
  *                               level of the logger, the message will not be
- *                               output to the log.
+ *                               output to the log. Messages of a level that
+ *                               is sampled in the configuration file are only
+ *                               output with the configured probability.
  *
  * Return values:
  *     LS_ERR_INIT_FAILED:       An internal initialization error has occured. This
@@ -142,6 +342,113 @@ int minix_ls_set_logger_level(const char* logger, minix_ls_log_level_t
 int minix_ls_write_log(const char* logger, const char* message,
 		minix_ls_log_level_t message_level);
 
+/*
+ * Writes a message to the log along with a list of typed key/value fields. The
+ * fields are sent to ls in a compact binary encoding and only turned into text
+ * by ls: the '%k' string inside the logger's format is substituted for them as
+ * space-separated key=value pairs, or, if the format has no '%k', they follow
+ * the message wherever '%m' is. The message and the encoded fields share the
+ * space of one message.
+ *
+ * Params:
+ *     logger:                   A null-terminated string containing the logger
+ *                               name.
+ *     message:                  A null-terminated string containing the message for
+ *                               this log line.
+ *     message_level:            Severity level of the message, as for
+ *                               minix_ls_write_log.
+ *     fields:                   The fields, e.g. built with the MINIX_LS_INT,
+ *                               MINIX_LS_STRING, MINIX_LS_HEX and
+ *                               MINIX_LS_ENDPOINT initializers. Keys must be
+ *                               non-empty and at most MINIX_LS_MAX_FIELD_KEY_LEN
+ *                               characters long.
+ *     nfields:                  The number of fields.
+ *
+ * Return values:
+ *     The same as for minix_ls_write_log. EINVAL is also returned if a field is
+ *     invalid, or the message and fields together are too big.
+ */
+int minix_ls_write_kv(const char* logger, const char* message,
+		minix_ls_log_level_t message_level, const minix_ls_field_t* fields,
+		int nfields);
+
+/*
+ * Writes a printf-style message to the log, leaving the formatting to ls. The
+ * first time a format string is used, it is registered with ls and gets a small
+ * id; after that, only the id and the raw argument values are sent. Lines that
+ * are filtered or sampled away are not formatted at all.
+ *
+ * Format strings are remembered by their text, so a buffer may be reused for
+ * another format. ls keeps at most 64 formats for each process, and the
+ * library remembers as many; lines with formats beyond that, or longer than
+ * 255 characters, are formatted by the calling process. ls renders the d,
+ * i, u, o, x, X, c, s and p conversions, with flags, a fixed width and
+ * precision, and the hh, h, l, ll and z length modifiers. Formats
+ * with anything else, e.g. floating point or a '*' width, still work, but are
+ * formatted by the calling process, as are lines for loggers that were not
+ * started by it.
+ *
+ * Params:
+ *     logger:                   A null-terminated string containing the logger
+ *                               name.
+ *     message_level:            Severity level of the message, as for
+ *                               minix_ls_write_log.
+ *     format:                   The printf format of the message, followed by its
+ *                               arguments.
+ *
+ * Return values:
+ *     The same as for minix_ls_write_log. Messages longer than the maximum are
+ *     truncated rather than refused.
+ */
+int minix_ls_writef(const char* logger, minix_ls_log_level_t message_level,
+		const char* format, ...) __printflike(3, 4);
+
+/*
+ * Tells whether a line of the given level would be kept by the logger, going by
+ * the severity cached when the calling process started it. A line that would
+ * not be kept is counted as filtered, just as if it had been written, so this
+ * is meant to be called right before writing, as the MINIX_LS_* macros do. For
+ * loggers the calling process did not start, 1 is returned and ls decides.
+ *
+ * Params:
+ *     logger:                   A null-terminated string containing the logger
+ *                               name.
+ *     message_level:            Severity level of the line.
+ *
+ * Return values:
+ *     1 if the line should be written, 0 if not.
+ */
+int minix_ls_would_log(const char* logger, minix_ls_log_level_t message_level);
+
+/*
+ * Logging macros. Levels below MINIX_LS_MIN_LEVEL are compiled out entirely,
+ * and for the others the arguments are only evaluated if the logger would keep
+ * the line, e.g.
+ *
+ *     #define MINIX_LS_MIN_LEVEL MINIX_LS_LEVEL_INFO
+ *     #include <minix/ls.h>
+ *     ...
+ *     MINIX_LS_TRACE("MyLogger", "state %s", dump_state());
+ *
+ * costs nothing at all. The lines are written with minix_ls_writef.
+ */
+#ifndef MINIX_LS_MIN_LEVEL
+#define MINIX_LS_MIN_LEVEL                MINIX_LS_LEVEL_TRACE
+#endif
+
+#define MINIX_LS_LOG(logger, level, ...) \
+	do { \
+		if ((level) >= MINIX_LS_MIN_LEVEL && \
+				minix_ls_would_log((logger), (level))) { \
+			(void) minix_ls_writef((logger), (level), __VA_ARGS__); \
+		} \
+	} while (0)
+
+#define MINIX_LS_TRACE(logger, ...) MINIX_LS_LOG(logger, MINIX_LS_LEVEL_TRACE, __VA_ARGS__)
+#define MINIX_LS_DEBUG(logger, ...) MINIX_LS_LOG(logger, MINIX_LS_LEVEL_DEBUG, __VA_ARGS__)
+#define MINIX_LS_INFO(logger, ...)  MINIX_LS_LOG(logger, MINIX_LS_LEVEL_INFO, __VA_ARGS__)
+#define MINIX_LS_WARN(logger, ...)  MINIX_LS_LOG(logger, MINIX_LS_LEVEL_WARN, __VA_ARGS__)
+
 /*
  * Clears specific or all logs. This truncates the files backing the logs back to
  * zero size. None of the logs must be open. If any of the logs is open, an error
@@ -166,3 +473,126 @@ int minix_ls_write_log(const char* logger, const char* message,
  *     EINVAL:                The logger name is too big to fit in an IPC message.
  */
 int minix_ls_clear_logs(const char* loggers);
+
+/*
+ * Creates a new logger at runtime from a template defined in the configuration
+ * file. The new logger behaves exactly like one declared with a logger block,
+ * and has to be started with minix_ls_start_log before it can be written to.
+ * Every occurence of %name in the template's filename is replaced by the name
+ * of the new logger; it is not expanded anywhere else, and in a format it
+ * reads as %n, the name of the writing process. Loggers created this way live
+ * until ls is initialized again, and their number is limited by the
+ * max_dynamic_loggers setting.
+ *
+ * Params:
+ *     logger:                  A null-terminated string containing the name of
+ *                              the new logger.
+ *     template_name:           A null-terminated string containing the name of
+ *                              the template to instantiate.
+ *     overrides:               A null-terminated, nullable string containing
+ *                              options that replace the template's ones, in the
+ *                              same `option = value` form, one per line, as
+ *                              inside a logger block.
+ *
+ * Return values:
+ *     LS_ERR_INIT_FAILED:      An internal initialization error has occured.
+ *                              This is most likely due to a bad config file.
+ *                              The kernel logs should have more info about what
+ *                              went wrong.
+ *     LS_ERR_NO_SUCH_TEMPLATE: There doesn't exist a template by this name.
+ *     LS_ERR_LOGGER_EXISTS:    A logger by this name already exists.
+ *     LS_ERR_LIMIT_REACHED:    The maximum number of dynamically created
+ *                              loggers has been reached.
+ *     EINVAL:                  The logger or template name is too long, or the
+ *                              overrides are too long or invalid.
+ */
+int minix_ls_create_logger(const char* logger, const char* template_name,
+		const char* overrides);
+
+/*
+ * Retrieves the counters of a logger. The logger does not need to be open, and
+ * any process can query any logger.
+ *
+ * Params:
+ *     logger:                A null-terminated string containing the logger
+ *                            name.
+ *     stats:                 Where to store the counters.
+ *
+ * Return values:
+ *     LS_ERR_INIT_FAILED:    An internal initialization error has occured. This
+ *                            is most likely due to a bad config file. The kernel
+ *                            logs should have more info about what went wrong.
+ *     LS_ERR_NO_SUCH_LOGGER: There doesn't exist a logger by this name.
+ *     EINVAL:                The logger name is too big to fit in an IPC
+ *                            message.
+ */
+int minix_ls_get_stats(const char* logger, minix_ls_stats_t* stats);
+
+/*
+ * Subscribes the calling process to a logger. From now on, every line the
+ * logger accepts at or above the given level is kept for the subscriber until
+ * it is read with minix_ls_read_subscription. The logger does not need to be
+ * open, and any process can subscribe to any logger, once, and to at most 4
+ * loggers. Subscriptions end when ls reads its configuration again, when ls
+ * is restarted, or when the subscriber exits.
+ *
+ * Params:
+ *     logger:                A null-terminated string containing the logger
+ *                            name.
+ *     min_level:             The lowest level of lines to receive.
+ *
+ * Return values:
+ *     A subscription, to be passed to minix_ls_read_subscription and
+ *     minix_ls_unsubscribe, if the call succeeds (never negative), or one of
+ *     the following errors:
+ *
+ *     LS_ERR_INIT_FAILED:    An internal initialization error has occured. This
+ *                            is most likely due to a bad config file. The kernel
+ *                            logs should have more info about what went wrong.
+ *     LS_ERR_NO_SUCH_LOGGER: There doesn't exist a logger by this name.
+ *     LS_ERR_LIMIT_REACHED:  ls already has as many subscribers as it can
+ *                            keep, or the process has as many subscriptions
+ *                            as it may.
+ *     EINVAL:                The logger name is too big to fit in an IPC
+ *                            message, the level is invalid, or the process
+ *                            is already subscribed to the logger.
+ */
+int minix_ls_subscribe(const char* logger, minix_ls_log_level_t min_level);
+
+/*
+ * Reads the lines received by a subscription since it was last read, as a
+ * sequence of minix_ls_record_t, as many as fit into the buffer. If there are
+ * none yet, the call blocks until there are. ls keeps a limited amount of
+ * lines for each subscriber; if the subscriber does not keep up, the oldest
+ * ones are dropped.
+ *
+ * Params:
+ *     subscription:          A subscription returned by minix_ls_subscribe.
+ *     buf:                   Where to store the records.
+ *     buf_len:               The size of buf, at least MINIX_LS_MAX_RECORD_LEN.
+ *     dropped:               If not NULL, where to store how many lines were
+ *                            dropped since the last read.
+ *
+ * Return values:
+ *     The number of bytes of records stored in buf if the call succeeds (never
+ *     negative), or one of the following errors:
+ *
+ *     LS_ERR_NO_SUCH_SUBSCRIPTION: The calling process does not have this
+ *                                  subscription, or it has ended. Subscribe
+ *                                  again to keep receiving lines.
+ *     EINVAL:                      The buffer is too small.
+ */
+int minix_ls_read_subscription(int subscription, void* buf, size_t buf_len,
+		unsigned int* dropped);
+
+/*
+ * Ends a subscription. Lines that have not been read yet are thrown away.
+ *
+ * Params:
+ *     subscription:          A subscription returned by minix_ls_subscribe.
+ *
+ * Return values:
+ *     LS_ERR_NO_SUCH_SUBSCRIPTION: The calling process does not have this
+ *                                  subscription, or it has already ended.
+ */
+int minix_ls_unsubscribe(int subscription);
@@ -270,6 +270,9 @@ pid_t getnpid(endpoint_t proc_ep);
 uid_t getnuid(endpoint_t proc_ep);
 gid_t getngid(endpoint_t proc_ep);
 int checkperms(endpoint_t endpt, char *path, size_t size);
+int ls_start_log(const char *logger, int *handle);
+int ls_write_grant(int handle, int level, const char *msg, size_t len);
+int ls_close_log(const char *logger);
 int copyfd(endpoint_t endpt, int fd, int what);
 #define COPYFD_FROM	0	/* copy file descriptor from remote process */
 #define COPYFD_TO	1	/* copy file descriptor to remote process */
@@ -4,10 +4,104 @@
 #include <minix/ipc.h>
 #include <sys/errno.h>
 #include <minix/syslib.h>
+#include <minix/minlib.h>
 #include <minix/ls.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
 #define OK 0
 
+#define MAX_MESSAGE_LEN                     2048
+#define MAX_OPEN_LOGGERS                    16
+#define MAX_INTERNED_FORMATS                64
+#define MAX_FORMAT_LEN                      256
+#define MAX_FORMAT_ARGS                     16
+#define MIN_BATCH_LEN                       256
+
+/* Loggers started by this process. ls hands out a handle, the severity and
+ * the sampling rates when a logger is started, so that lines which would be
+ * thrown away never leave the process, and the rest are sent by handle. What
+ * was thrown away here is reported to ls with the next line that is sent, or
+ * when the logger is closed.
+ *
+ * Loggers started with minix_ls_start_log_buffered also have a buffer, in the
+ * format of LS_WRITE_BATCH. There are no timers in here, so flush_ms is checked
+ * against the TSC whenever a line is added; ls tells us how fast the TSC goes
+ * when the logger is started. */
+typedef struct open_logger_t {
+	char name[LS_IPC_LOGGER_MAX_NAME_LEN];
+	int handle;
+	int severity;
+	unsigned int sample_every[4];
+	unsigned int filtered;
+	unsigned int sampled;
+	unsigned int tsc_khz;
+	char* buf;
+	size_t buf_size;
+	size_t buf_len;
+	u64_t buf_first_tsc;
+	u64_t flush_ticks;
+} open_logger_t;
+
+static open_logger_t open_loggers[MAX_OPEN_LOGGERS];
+
+/* Formats of minix_ls_writef that have been registered with ls, and the types
+ * of their arguments. An id of -1 means the format is rendered here, and 0
+ * marks a free entry. Formats are kept by their text rather than by address,
+ * so a buffer that is reused for another format is not mistaken for the one it
+ * held before. */
+typedef struct interned_format_t {
+	char format[MAX_FORMAT_LEN];
+	unsigned int hash;
+	int id;
+	int nargs;
+	unsigned char args[MAX_FORMAT_ARGS];
+	int precision[MAX_FORMAT_ARGS];
+} interned_format_t;
+
+enum {
+	ARG_INT, ARG_SCHAR, ARG_SHORT, ARG_LONG, ARG_LLONG, ARG_SSIZE,
+	ARG_UINT, ARG_UCHAR, ARG_USHORT, ARG_ULONG, ARG_ULLONG, ARG_SIZE,
+	ARG_PTR, ARG_STRING
+};
+
+enum { LEN_NONE, LEN_HH, LEN_H, LEN_L, LEN_LL, LEN_Z };
+
+static interned_format_t interned_formats[MAX_INTERNED_FORMATS];
+static unsigned int sample_state;
+static int flush_at_exit;
+
 int wrap_syscall(int, message*);
+static open_logger_t* find_open_logger(const char*);
+static open_logger_t* add_open_logger(const char*);
+static void forget_open_logger(open_logger_t*);
+static int flush_buffer(open_logger_t*);
+static int flush_overdue(void);
+static int flush_all(void);
+static void flush_all_at_exit(void);
+static int is_stale_handle(int);
+static int sample_keep(unsigned int*, unsigned int);
+static int append_batch_line(char*, size_t*, size_t, const char*, size_t, minix_ls_log_level_t, int, u64_t*);
+static int send_batch(int, char*, size_t, unsigned int*, unsigned int*);
+static int send_batch_by_name(const char*, const char*, size_t);
+static int keep_line(open_logger_t*, minix_ls_log_level_t);
+static int send_line(open_logger_t*, const char*, const char*, size_t, minix_ls_log_level_t, int);
+static int write_payload(const char*, const char*, size_t, minix_ls_log_level_t);
+static int put_varint(char*, size_t*, unsigned long long);
+static int put_bytes(char*, size_t*, const char*, size_t);
+static unsigned long long zigzag(long long);
+static int put_field(char*, size_t*, const minix_ls_field_t*);
+static int parse_format(const char*, interned_format_t*);
+static interned_format_t* intern_format(const char*);
+static int encode_args(const interned_format_t*, va_list, char*);
+static int get_varint(const unsigned char**, const unsigned char*, unsigned long long*);
+static interned_format_t* find_interned_id(int);
+static int render_args(const interned_format_t*, const char*, size_t, char*, size_t);
+static int render_buffered(open_logger_t*);
+static void forget_formats(void);
 
 int wrap_syscall(int nr, message* m) {
 	int ret = _syscall(LS_PROC_NR, nr, m);
@@ -18,9 +112,227 @@ int wrap_syscall(int nr, message* m) {
 	}
 }
 
+static open_logger_t* find_open_logger(const char* logger) {
+	int i;
+	for (i = 0; i < MAX_OPEN_LOGGERS; i++) {
+		if (open_loggers[i].name[0] && strcmp(open_loggers[i].name, logger) == 0) {
+			return &open_loggers[i];
+		}
+	}
+
+	return NULL;
+}
+
+static open_logger_t* add_open_logger(const char* logger) {
+	open_logger_t* ol = find_open_logger(logger);
+	int i;
+
+	for (i = 0; !ol && i < MAX_OPEN_LOGGERS; i++) {
+		if (!open_loggers[i].name[0]) {
+			ol = &open_loggers[i];
+		}
+	}
+
+	if (ol) {
+		forget_open_logger(ol);
+		strncpy(ol->name, logger, LS_IPC_LOGGER_MAX_NAME_LEN - 1);
+	}
+
+	return ol;
+}
+
+static void forget_open_logger(open_logger_t* ol) {
+	free(ol->buf);
+	memset(ol, 0, sizeof(*ol));
+}
+
+static int is_stale_handle(int ret) {
+	return ret == LS_ERR_NO_SUCH_LOGGER || ret == LS_ERR_LOGGER_NOT_OPEN ||
+		ret == LS_ERR_PERMISSION_DENIED;
+}
+
+/* Hands the buffered lines to ls. They are gone from the buffer afterwards,
+ * whether ls took them or not. If ls refuses the batch because it does not
+ * know one of its formats, e.g. after it was restarted, the lines with a
+ * format are rendered here and the batch is sent again. */
+static int flush_buffer(open_logger_t* ol) {
+	if (ol->buf_len == 0) {
+		return OK;
+	}
+
+	int ret = send_batch(ol->handle, ol->buf, ol->buf_len, &ol->filtered, &ol->sampled);
+	if (ret == LS_ERR_NO_SUCH_FORMAT) {
+		forget_formats();
+		ret = ol->buf_len > 0 ? send_batch(ol->handle, ol->buf, ol->buf_len, &ol->filtered, &ol->sampled) : OK;
+	}
+	if (is_stale_handle(ret)) {
+		ret = send_batch_by_name(ol->name, ol->buf, ol->buf_len);
+		forget_open_logger(ol);
+	}
+	ol->buf_len = 0;
+
+	return ret;
+}
+
+/* There are no timers in here, so buffers that are due to be flushed are
+ * flushed by the next line that is written, to any logger. */
+static int flush_overdue() {
+	int ret = OK;
+	u64_t now;
+	int i;
+
+	read_tsc_64(&now);
+	for (i = 0; i < MAX_OPEN_LOGGERS; i++) {
+		open_logger_t* ol = &open_loggers[i];
+		if (ol->buf_len > 0 && ol->flush_ticks && now - ol->buf_first_tsc >= ol->flush_ticks) {
+			int ret_logger = flush_buffer(ol);
+			if (ret == OK) {
+				ret = ret_logger;
+			}
+		}
+	}
+
+	return ret;
+}
+
+static int flush_all() {
+	int ret = OK;
+	int i;
+
+	for (i = 0; i < MAX_OPEN_LOGGERS; i++) {
+		if (open_loggers[i].buf) {
+			int ret_logger = flush_buffer(&open_loggers[i]);
+			if (ret == OK) {
+				ret = ret_logger;
+			}
+		}
+	}
+
+	return ret;
+}
+
+static void flush_all_at_exit() {
+	flush_all();
+}
+
+/* Adds a line to a buffer in the format of LS_WRITE_BATCH, stamped with the
+ * current TSC. Returns 0 if it does not fit. */
+static int append_batch_line(char* buf, size_t* len, size_t size, const char* payload, size_t payload_len,
+		minix_ls_log_level_t message_level, int format_id, u64_t* tsc) {
+	size_t need = sizeof(ls_batch_line_t) + LS_BATCH_ALIGN(payload_len);
+	ls_batch_line_t line;
+
+	if (need > size - *len) {
+		return 0;
+	}
+
+	memset(&line, 0, sizeof(line));
+	read_tsc_64(&line.tsc);
+	line.severity = (uint16_t) message_level;
+	line.format_id = (uint16_t) format_id;
+	line.message_len = (uint16_t) payload_len;
+
+	memcpy(buf + *len, &line, sizeof(line));
+	memcpy(buf + *len + sizeof(line), payload, payload_len);
+	*len += need;
+	*tsc = line.tsc;
+
+	return 1;
+}
+
+/* Sends a buffer of lines, along with the counters of lines thrown away before
+ * they got into it. The counters are reset once ls has taken them. */
+static int send_batch(int handle, char* buf, size_t len, unsigned int* filtered, unsigned int* sampled) {
+	message m;
+
+	memset(&m, 0, sizeof(m));
+	m.m_ls_write_batch.handle = handle;
+	m.m_ls_write_batch.batch = buf;
+	m.m_ls_write_batch.batch_len = (uint32_t) len;
+	m.m_ls_write_batch.filtered = *filtered;
+	m.m_ls_write_batch.sampled = *sampled;
+
+	int ret = wrap_syscall(LS_WRITE_BATCH, &m);
+	if (ret == OK) {
+		*filtered = 0;
+		*sampled = 0;
+	}
+
+	return ret;
+}
+
+/* Sends the lines of a batch one by one, by the logger's name, for when the
+ * handle the batch was made for has gone stale. Lines with a format are
+ * rendered here. */
+static int send_batch_by_name(const char* logger, const char* buf, size_t len) {
+	char text[MAX_MESSAGE_LEN + 1];
+	size_t pos = 0;
+	int ret = OK;
+	message m;
+
+	while (len - pos >= sizeof(ls_batch_line_t)) {
+		ls_batch_line_t line;
+		const char* payload = buf + pos + sizeof(line);
+		int payload_len;
+
+		memcpy(&line, buf + pos, sizeof(line));
+		pos += sizeof(line) + LS_BATCH_ALIGN(line.message_len);
+		payload_len = line.message_len;
+
+		if (line.format_id) {
+			interned_format_t* f = find_interned_id(line.format_id);
+			if (!f || (payload_len = render_args(f, payload, line.message_len, text, sizeof(text))) < 0) {
+				continue;
+			}
+			payload = text;
+		}
+
+		memset(&m, 0, sizeof(m));
+		strncpy(m.m_ls_write_log.logger, logger, LS_IPC_LOGGER_MAX_NAME_LEN);
+		m.m_ls_write_log.message = (void*) payload;
+		m.m_ls_write_log.message_len = (uint16_t) payload_len;
+		m.m_ls_write_log.severity = line.severity;
+
+		int ret_line = wrap_syscall(LS_WRITE_LOG, &m);
+		if (ret == OK) {
+			ret = ret_line;
+		}
+	}
+
+	return ret;
+}
+
+/* Keeps a line with probability 1/every. */
+static int sample_keep(unsigned int* state, unsigned int every) {
+	unsigned int x;
+
+	if (every <= 1) {
+		return 1;
+	}
+
+	if (!*state) {
+		*state = ((unsigned int)getpid() * 2654435761u) | 1;
+	}
+
+	/* xorshift32 */
+	x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+
+	return x % every == 0;
+}
+
 int minix_ls_initialize() {
 	message m;
 	memset(&m, 0, sizeof(m));
+
+	/* All handles given out so far are about to become invalid. */
+	flush_all();
+	for (int i = 0; i < MAX_OPEN_LOGGERS; i++) {
+		forget_open_logger(&open_loggers[i]);
+	}
 	return wrap_syscall(LS_INITIALIZE, &m);
 }
 
@@ -29,10 +341,146 @@ int minix_ls_start_log(const char* logger) {
 		return -EINVAL;
 	}
 
+	/* Lines buffered before the logger is started again go out with the old
+	 * settings. */
+	open_logger_t* buffered = find_open_logger(logger);
+	if (buffered && buffered->buf) {
+		flush_buffer(buffered);
+	}
+
 	message m;
 	memset(&m, 0, sizeof(m));
 	strncpy(m.m_ls_start_log.logger, logger, LS_IPC_LOGGER_MAX_NAME_LEN);
-	return wrap_syscall(LS_START_LOG, &m);
+
+	int ret = wrap_syscall(LS_START_LOG, &m);
+	if (ret == OK) {
+		open_logger_t* ol = add_open_logger(logger);
+		if (ol) {
+			int i;
+			ol->handle = m.m_ls_start_log_reply.handle;
+			ol->severity = m.m_ls_start_log_reply.severity;
+			ol->tsc_khz = m.m_ls_start_log_reply.tsc_khz;
+			for (i = 0; i < 4; i++) {
+				ol->sample_every[i] = m.m_ls_start_log_reply.sample_every[i];
+			}
+		}
+	}
+
+	return ret;
+}
+
+int minix_ls_start_log_buffered(const char* logger, size_t bufsize, unsigned int flush_ms) {
+	if (bufsize < MIN_BATCH_LEN) {
+		return -EINVAL;
+	} else if (bufsize > MINIX_LS_MAX_BATCH_LEN) {
+		bufsize = MINIX_LS_MAX_BATCH_LEN;
+	}
+
+	int ret = minix_ls_start_log(logger);
+	if (ret != OK) {
+		return ret;
+	}
+
+	open_logger_t* ol = find_open_logger(logger);
+	if (!ol || !(ol->buf = malloc(bufsize))) {
+		return -ENOMEM;
+	}
+
+	ol->buf_size = bufsize;
+	ol->flush_ticks = (u64_t) flush_ms * ol->tsc_khz;
+
+	if (!flush_at_exit && atexit(flush_all_at_exit) == 0) {
+		flush_at_exit = 1;
+	}
+
+	return OK;
+}
+
+int minix_ls_flush(const char* logger) {
+	open_logger_t* ol = find_open_logger(logger);
+	if (!ol || !ol->buf) {
+		return OK;
+	}
+
+	return flush_buffer(ol);
+}
+
+int minix_ls_stage_init(minix_ls_stage_t* stage, const char* logger, void* buf, size_t bufsize) {
+	int i;
+
+	if (strlen(logger) >= LS_IPC_LOGGER_MAX_NAME_LEN - 1 ||
+			bufsize < MIN_BATCH_LEN || bufsize > MINIX_LS_MAX_BATCH_LEN) {
+		return -EINVAL;
+	}
+
+	open_logger_t* ol = find_open_logger(logger);
+	if (!ol) {
+		return LS_ERR_LOGGER_NOT_OPEN;
+	}
+
+	memset(stage, 0, sizeof(*stage));
+	strncpy(stage->logger, logger, sizeof(stage->logger) - 1);
+	stage->handle = ol->handle;
+	stage->severity = ol->severity;
+	for (i = 0; i < 4; i++) {
+		stage->sample_every[i] = ol->sample_every[i];
+	}
+	stage->sample_state = (unsigned int) (uintptr_t) stage * 2654435761u | 1;
+	stage->buf = buf;
+	stage->buf_size = bufsize;
+
+	return OK;
+}
+
+int minix_ls_stage_write(minix_ls_stage_t* stage, const char* _message, minix_ls_log_level_t message_level) {
+	size_t message_len = strlen(_message);
+	u64_t tsc;
+	int ret = OK;
+
+	if (message_len > MAX_MESSAGE_LEN ||
+			message_level < MINIX_LS_LEVEL_TRACE ||
+			message_level > MINIX_LS_LEVEL_WARN) {
+		return -EINVAL;
+	}
+
+	if (message_level < stage->severity) {
+		stage->filtered++;
+		return OK;
+	}
+
+	if (!sample_keep(&stage->sample_state, stage->sample_every[message_level])) {
+		stage->sampled++;
+		return OK;
+	}
+
+	if (!append_batch_line(stage->buf, &stage->buf_len, stage->buf_size, _message, message_len,
+			message_level, 0, &tsc)) {
+		ret = minix_ls_stage_flush(stage);
+		if (!append_batch_line(stage->buf, &stage->buf_len, stage->buf_size, _message, message_len,
+				message_level, 0, &tsc)) {
+			return -EINVAL;
+		}
+	}
+
+	return ret;
+}
+
+int minix_ls_stage_flush(minix_ls_stage_t* stage) {
+	if (stage->buf_len == 0) {
+		return OK;
+	}
+
+	int ret = stage->handle >= 0 ?
+		send_batch(stage->handle, stage->buf, stage->buf_len, &stage->filtered, &stage->sampled) :
+		LS_ERR_NO_SUCH_LOGGER;
+	if (is_stale_handle(ret)) {
+		/* Like send_line, let ls sort it out by name. */
+		stage->handle = -1;
+		ret = send_batch_by_name(stage->logger, stage->buf, stage->buf_len);
+	}
+	stage->buf_len = 0;
+
+	return ret;
 }
 
 int minix_ls_close_log(const char* logger) {
@@ -43,22 +491,689 @@ int minix_ls_close_log(const char* logger) {
 	message m;
 	memset(&m, 0, sizeof(m));
 	strncpy(m.m_ls_close_log.logger, logger, LS_IPC_LOGGER_MAX_NAME_LEN);
-	return wrap_syscall(LS_CLOSE_LOG, &m);
+
+	open_logger_t* ol = find_open_logger(logger);
+	int flush_ret = OK;
+	if (ol && ol->buf) {
+		flush_ret = flush_buffer(ol);
+		ol = find_open_logger(logger);
+	}
+	if (ol) {
+		m.m_ls_close_log.filtered = ol->filtered;
+		m.m_ls_close_log.sampled = ol->sampled;
+	}
+
+	int ret = wrap_syscall(LS_CLOSE_LOG, &m);
+	if (ol && ret != LS_ERR_PERMISSION_DENIED) {
+		forget_open_logger(ol);
+	}
+
+	return ret == OK ? flush_ret : ret;
 }
 
-int minix_ls_write_log(const char* logger, const char* _message, minix_ls_log_level_t message_level) {
-	if (strlen(logger) >= LS_IPC_LOGGER_MAX_NAME_LEN - 1) {
-		return -EINVAL;
+/* Drops lines below the logger's severity, and lines sampled away. */
+static int keep_line(open_logger_t* ol, minix_ls_log_level_t message_level) {
+	if (message_level < ol->severity) {
+		ol->filtered++;
+		return 0;
+	}
+
+	if (!sample_keep(&sample_state, ol->sample_every[message_level])) {
+		ol->sampled++;
+		return 0;
 	}
 
+	return 1;
+}
+
+/* Sends a line that has been through keep_line. The payload is the message,
+ * optionally followed by a NUL and the encoded fields of minix_ls_write_kv, or
+ * the encoded arguments of format_id for minix_ls_writef. Lines with a format
+ * id can only be sent by handle; LS_ERR_NO_SUCH_FORMAT is returned if that is
+ * not possible. */
+static int send_line(open_logger_t* ol, const char* logger, const char* payload, size_t payload_len,
+		minix_ls_log_level_t message_level, int format_id) {
 	message m;
+
+	flush_overdue();
+	if (ol && !ol->name[0]) {
+		ol = NULL;
+	}
+	if (format_id && !find_interned_id(format_id)) {
+		return LS_ERR_NO_SUCH_FORMAT;
+	}
+
+	if (ol && ol->buf) {
+		size_t need = sizeof(ls_batch_line_t) + LS_BATCH_ALIGN(payload_len);
+		int ret = OK;
+
+		if (ol->buf_len > 0 && need > ol->buf_size - ol->buf_len) {
+			ret = flush_buffer(ol);
+		}
+
+		/* The flush found that ls has lost the format of this line. */
+		if (format_id && !find_interned_id(format_id)) {
+			return LS_ERR_NO_SUCH_FORMAT;
+		}
+
+		u64_t tsc;
+		if (ol->buf && append_batch_line(ol->buf, &ol->buf_len, ol->buf_size, payload, payload_len,
+				message_level, format_id, &tsc)) {
+			if (ol->buf_len == need) {
+				ol->buf_first_tsc = tsc;
+			}
+
+			if (ol->flush_ticks && tsc - ol->buf_first_tsc >= ol->flush_ticks) {
+				int ret_flush = flush_buffer(ol);
+				if (ret == OK) {
+					ret = ret_flush;
+				}
+			}
+
+			return ret;
+		}
+
+		/* The handle went stale while flushing, or the line is larger than the
+		 * whole buffer. */
+		if (!ol->name[0]) {
+			ol = NULL;
+		}
+	}
+
+	if (ol) {
+		memset(&m, 0, sizeof(m));
+		m.m_ls_write.handle = ol->handle;
+		m.m_ls_write.message = (void*) payload;
+		m.m_ls_write.message_len = (uint16_t) payload_len;
+		m.m_ls_write.severity = (uint16_t) message_level;
+		m.m_ls_write.format_id = (uint16_t) format_id;
+		m.m_ls_write.filtered = ol->filtered;
+		m.m_ls_write.sampled = ol->sampled;
+		read_tsc_64(&m.m_ls_write.tsc);
+
+		int ret = wrap_syscall(LS_WRITE, &m);
+		if (ret == OK) {
+			ol->filtered = 0;
+			ol->sampled = 0;
+			return OK;
+		} else if (!is_stale_handle(ret)) {
+			return ret;
+		}
+
+		/* The handle is stale, e.g. ls has been initialized again since the
+		 * logger was started. Let ls sort it out by name. */
+		forget_open_logger(ol);
+	}
+
+	if (format_id) {
+		return LS_ERR_NO_SUCH_FORMAT;
+	}
+
 	memset(&m, 0, sizeof(m));
 	strncpy(m.m_ls_write_log.logger, logger, LS_IPC_LOGGER_MAX_NAME_LEN);
-	m.m_ls_write_log.message = _message;
-	m.m_ls_write_log.message_len = strlen(_message);
+	m.m_ls_write_log.message = (void*) payload;
+	m.m_ls_write_log.message_len = (uint16_t) payload_len;
 	m.m_ls_write_log.severity = (int) message_level;
 	return wrap_syscall(LS_WRITE_LOG, &m);
+}
+
+static int write_payload(const char* logger, const char* payload, size_t payload_len, minix_ls_log_level_t message_level) {
+	open_logger_t* ol = find_open_logger(logger);
+	if (ol && !keep_line(ol, message_level)) {
+		return OK;
+	}
 
+	return send_line(ol, logger, payload, payload_len, message_level, 0);
+}
+
+int minix_ls_write_log(const char* logger, const char* _message, minix_ls_log_level_t message_level) {
+	size_t message_len = strlen(_message);
+
+	if (strlen(logger) >= LS_IPC_LOGGER_MAX_NAME_LEN - 1 ||
+			message_len > MAX_MESSAGE_LEN ||
+			message_level < MINIX_LS_LEVEL_TRACE ||
+			message_level > MINIX_LS_LEVEL_WARN) {
+		return -EINVAL;
+	}
+
+	return write_payload(logger, _message, message_len, message_level);
+}
+
+/* Fields are encoded after the message and a NUL, one after another, as the
+ * type byte, the key length byte, the key, and the value. Numbers are LEB128
+ * varints, zigzag-encoded for MINIX_LS_FIELD_INT and MINIX_LS_FIELD_ENDPOINT;
+ * strings are a varint length followed by the bytes. */
+static int put_varint(char* buf, size_t* pos, unsigned long long v) {
+	do {
+		if (*pos >= MAX_MESSAGE_LEN) {
+			return -EINVAL;
+		}
+
+		buf[(*pos)++] = (char) ((v & 0x7f) | (v > 0x7f ? 0x80 : 0));
+		v >>= 7;
+	} while (v);
+
+	return OK;
+}
+
+static int put_bytes(char* buf, size_t* pos, const char* bytes, size_t len) {
+	if (len > MAX_MESSAGE_LEN - *pos) {
+		return -EINVAL;
+	}
+
+	memcpy(buf + *pos, bytes, len);
+	*pos += len;
+	return OK;
+}
+
+static unsigned long long zigzag(long long v) {
+	return ((unsigned long long) v << 1) ^ (unsigned long long) (v >> 63);
+}
+
+static int put_field(char* buf, size_t* pos, const minix_ls_field_t* f) {
+	size_t key_len = f->key ? strlen(f->key) : 0;
+	char header[2];
+
+	if (key_len == 0 || key_len > MINIX_LS_MAX_FIELD_KEY_LEN) {
+		return -EINVAL;
+	}
+
+	header[0] = (char) f->type;
+	header[1] = (char) key_len;
+	if (put_bytes(buf, pos, header, 2) != OK || put_bytes(buf, pos, f->key, key_len) != OK) {
+		return -EINVAL;
+	}
+
+	switch (f->type) {
+		case MINIX_LS_FIELD_INT:
+			return put_varint(buf, pos, zigzag(f->value.i));
+
+		case MINIX_LS_FIELD_HEX:
+			return put_varint(buf, pos, f->value.u);
+
+		case MINIX_LS_FIELD_ENDPOINT:
+			return put_varint(buf, pos, zigzag(f->value.endpoint));
+
+		case MINIX_LS_FIELD_STRING: {
+			const char* v = f->value.s ? f->value.s : "";
+			size_t len = strlen(v);
+			if (put_varint(buf, pos, len) != OK) {
+				return -EINVAL;
+			}
+
+			return put_bytes(buf, pos, v, len);
+		}
+
+		default:
+			return -EINVAL;
+	}
+}
+
+int minix_ls_write_kv(const char* logger, const char* _message, minix_ls_log_level_t message_level,
+		const minix_ls_field_t* fields, int nfields) {
+	char payload[MAX_MESSAGE_LEN];
+	size_t message_len = strlen(_message);
+	size_t pos;
+	int i;
+
+	if (strlen(logger) >= LS_IPC_LOGGER_MAX_NAME_LEN - 1 ||
+			message_len >= MAX_MESSAGE_LEN ||
+			message_level < MINIX_LS_LEVEL_TRACE ||
+			message_level > MINIX_LS_LEVEL_WARN ||
+			nfields < 0 || (nfields > 0 && !fields)) {
+		return -EINVAL;
+	}
+
+	memcpy(payload, _message, message_len);
+	payload[message_len] = '\0';
+	pos = message_len + 1;
+
+	for (i = 0; i < nfields; i++) {
+		if (put_field(payload, &pos, &fields[i]) != OK) {
+			return -EINVAL;
+		}
+	}
+
+	return write_payload(logger, payload, nfields > 0 ? pos : message_len, message_level);
+}
+
+/* Parses a format for minix_ls_writef into the types of its arguments. Only
+ * what ls can render is accepted; anything else, e.g. floating point or '*'
+ * widths, is formatted here instead. Returns the number of arguments, or -1. */
+static int parse_format(const char* format, interned_format_t* f) {
+	int nargs = 0;
+
+	while (*format) {
+		int precision = -1;
+		int length = LEN_NONE;
+		int arg;
+
+		if (*format++ != '%') {
+			continue;
+		}
+
+		while (*format && strchr("-0+ #", *format)) {
+			format++;
+		}
+		while (*format >= '0' && *format <= '9') {
+			format++;
+		}
+		if (*format == '.') {
+			precision = 0;
+			for (format++; *format >= '0' && *format <= '9'; format++) {
+				precision = precision * 10 + (*format - '0');
+			}
+		}
+
+		if (format[0] == 'h' && format[1] == 'h') {
+			length = LEN_HH;
+			format += 2;
+		} else if (format[0] == 'l' && format[1] == 'l') {
+			length = LEN_LL;
+			format += 2;
+		} else if (*format == 'h') {
+			length = LEN_H;
+			format++;
+		} else if (*format == 'l') {
+			length = LEN_L;
+			format++;
+		} else if (*format == 'z') {
+			length = LEN_Z;
+			format++;
+		}
+
+		switch (*format++) {
+			case '%':
+				continue;
+
+			case 'd':
+			case 'i':
+				switch (length) {
+					case LEN_HH: arg = ARG_SCHAR; break;
+					case LEN_H: arg = ARG_SHORT; break;
+					case LEN_L: arg = ARG_LONG; break;
+					case LEN_LL: arg = ARG_LLONG; break;
+					case LEN_Z: arg = ARG_SSIZE; break;
+					default: arg = ARG_INT; break;
+				}
+				break;
+
+			case 'u':
+			case 'o':
+			case 'x':
+			case 'X':
+				switch (length) {
+					case LEN_HH: arg = ARG_UCHAR; break;
+					case LEN_H: arg = ARG_USHORT; break;
+					case LEN_L: arg = ARG_ULONG; break;
+					case LEN_LL: arg = ARG_ULLONG; break;
+					case LEN_Z: arg = ARG_SIZE; break;
+					default: arg = ARG_UINT; break;
+				}
+				break;
+
+			case 'c':
+				arg = length ? -1 : ARG_UCHAR;
+				break;
+
+			case 's':
+				arg = length ? -1 : ARG_STRING;
+				break;
+
+			case 'p':
+				arg = length ? -1 : ARG_PTR;
+				break;
+
+			default:
+				arg = -1;
+				break;
+		}
+
+		if (arg < 0 || nargs == MAX_FORMAT_ARGS) {
+			return -1;
+		}
+
+		f->args[nargs] = (unsigned char) arg;
+		f->precision[nargs] = precision;
+		nargs++;
+	}
+
+	return nargs;
+}
+
+static unsigned int hash_format(const char* format, size_t* len) {
+	unsigned int hash = 2166136261u;
+	const char* p;
+
+	for (p = format; *p; p++) {
+		hash = (hash ^ (unsigned char) *p) * 16777619u;
+	}
+	*len = p - format;
+
+	return hash;
+}
+
+/* Finds the id ls gave to a format, registering the format on first use.
+ * Returns NULL if the format is too long to be kept, or if there is no room
+ * left to remember another one. */
+static interned_format_t* intern_format(const char* format) {
+	interned_format_t* f = NULL;
+	message m;
+	size_t len;
+	unsigned int hash = hash_format(format, &len);
+	int i;
+
+	if (len >= MAX_FORMAT_LEN) {
+		return NULL;
+	}
+
+	for (i = 0; i < MAX_INTERNED_FORMATS; i++) {
+		f = &interned_formats[(hash + i) % MAX_INTERNED_FORMATS];
+		if (f->id && f->hash == hash && strcmp(f->format, format) == 0) {
+			return f;
+		} else if (!f->id) {
+			break;
+		}
+	}
+
+	if (i == MAX_INTERNED_FORMATS) {
+		return NULL;
+	}
+
+	memset(f, 0, sizeof(*f));
+	memcpy(f->format, format, len + 1);
+	f->hash = hash;
+	f->id = -1;
+
+	if ((f->nargs = parse_format(format, f)) < 0) {
+		return f;
+	}
+
+	memset(&m, 0, sizeof(m));
+	m.m_ls_register_format.format = (void*) format;
+	m.m_ls_register_format.format_len = (uint16_t) len;
+	if (wrap_syscall(LS_REGISTER_FORMAT, &m) == OK) {
+		f->id = m.m_ls_register_format_reply.format_id;
+	}
+
+	return f;
+}
+
+/* Encodes the arguments of a line, each narrowed to the type its conversion
+ * asks for, as varints (zigzag for signed types) and length-prefixed strings.
+ * Returns the length of the encoding, or -1 if it does not fit. */
+static int encode_args(const interned_format_t* f, va_list ap, char* buf) {
+	size_t pos = 0;
+	int ret = OK;
+	int i;
+
+	for (i = 0; i < f->nargs && ret == OK; i++) {
+		switch (f->args[i]) {
+			case ARG_INT: ret = put_varint(buf, &pos, zigzag(va_arg(ap, int))); break;
+			case ARG_SCHAR: ret = put_varint(buf, &pos, zigzag((signed char) va_arg(ap, int))); break;
+			case ARG_SHORT: ret = put_varint(buf, &pos, zigzag((short) va_arg(ap, int))); break;
+			case ARG_LONG: ret = put_varint(buf, &pos, zigzag(va_arg(ap, long))); break;
+			case ARG_LLONG: ret = put_varint(buf, &pos, zigzag(va_arg(ap, long long))); break;
+			case ARG_SSIZE: ret = put_varint(buf, &pos, zigzag(va_arg(ap, ssize_t))); break;
+			case ARG_UINT: ret = put_varint(buf, &pos, va_arg(ap, unsigned int)); break;
+			case ARG_UCHAR: ret = put_varint(buf, &pos, (unsigned char) va_arg(ap, int)); break;
+			case ARG_USHORT: ret = put_varint(buf, &pos, (unsigned short) va_arg(ap, int)); break;
+			case ARG_ULONG: ret = put_varint(buf, &pos, va_arg(ap, unsigned long)); break;
+			case ARG_ULLONG: ret = put_varint(buf, &pos, va_arg(ap, unsigned long long)); break;
+			case ARG_SIZE: ret = put_varint(buf, &pos, va_arg(ap, size_t)); break;
+			case ARG_PTR: ret = put_varint(buf, &pos, (uintptr_t) va_arg(ap, void*)); break;
+
+			case ARG_STRING: {
+				const char* str = va_arg(ap, const char*);
+				size_t len;
+
+				if (!str) {
+					str = "(null)";
+				}
+				len = f->precision[i] >= 0 ? strnlen(str, f->precision[i]) : strlen(str);
+				if ((ret = put_varint(buf, &pos, len)) == OK) {
+					ret = put_bytes(buf, &pos, str, len);
+				}
+				break;
+			}
+		}
+	}
+
+	return ret == OK ? (int) pos : -1;
+}
+
+static int get_varint(const unsigned char** p, const unsigned char* end, unsigned long long* v) {
+	int shift = 0;
+
+	*v = 0;
+	while (*p < end && shift < 64) {
+		unsigned char b = *(*p)++;
+		*v |= (unsigned long long) (b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			return 1;
+		}
+		shift += 7;
+	}
+
+	return 0;
+}
+
+static interned_format_t* find_interned_id(int id) {
+	int i;
+
+	for (i = 0; i < MAX_INTERNED_FORMATS; i++) {
+		if (interned_formats[i].id == id) {
+			return &interned_formats[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* Renders a line from its format and the arguments encode_args made of it,
+ * for when ls no longer knows the format. Each conversion is handed to
+ * snprintf with its argument narrowed back to the type it was encoded from.
+ * Returns the length of the line, or -1 if the arguments are malformed. */
+static int render_args(const interned_format_t* f, const char* args, size_t args_len, char* out, size_t size) {
+	const unsigned char* p = (const unsigned char*) args;
+	const unsigned char* end = p + args_len;
+	const char* format = f->format;
+	char str[MAX_MESSAGE_LEN + 1];
+	char spec[MAX_FORMAT_LEN];
+	unsigned long long v;
+	long long sv;
+	size_t pos = 0;
+	int nargs = 0;
+	int n;
+
+	while (*format && pos + 1 < size) {
+		if (*format != '%') {
+			out[pos++] = *format++;
+			continue;
+		}
+
+		size_t spec_len = strspn(format + 1, "-0+ #123456789.hlz") + 2;
+		memcpy(spec, format, spec_len);
+		spec[spec_len] = '\0';
+		format += spec_len;
+
+		if (spec[spec_len - 1] == '%') {
+			out[pos++] = '%';
+			continue;
+		}
+
+		if (nargs == f->nargs || !get_varint(&p, end, &v)) {
+			return -1;
+		}
+		sv = (long long) (v >> 1) ^ -(long long) (v & 1);
+
+		switch (f->args[nargs++]) {
+			case ARG_INT: case ARG_SCHAR: case ARG_SHORT: n = snprintf(out + pos, size - pos, spec, (int) sv); break;
+			case ARG_LONG: n = snprintf(out + pos, size - pos, spec, (long) sv); break;
+			case ARG_LLONG: n = snprintf(out + pos, size - pos, spec, sv); break;
+			case ARG_SSIZE: n = snprintf(out + pos, size - pos, spec, (ssize_t) sv); break;
+			case ARG_UINT: case ARG_UCHAR: case ARG_USHORT: n = snprintf(out + pos, size - pos, spec, (unsigned int) v); break;
+			case ARG_ULONG: n = snprintf(out + pos, size - pos, spec, (unsigned long) v); break;
+			case ARG_ULLONG: n = snprintf(out + pos, size - pos, spec, v); break;
+			case ARG_SIZE: n = snprintf(out + pos, size - pos, spec, (size_t) v); break;
+			case ARG_PTR: n = snprintf(out + pos, size - pos, spec, (void*) (uintptr_t) v); break;
+
+			case ARG_STRING:
+				if (v > (unsigned long long) (end - p) || v > MAX_MESSAGE_LEN) {
+					return -1;
+				}
+				memcpy(str, p, v);
+				str[v] = '\0';
+				p += v;
+				n = snprintf(out + pos, size - pos, spec, str);
+				break;
+
+			default:
+				return -1;
+		}
+
+		if (n < 0) {
+			return -1;
+		}
+		pos += (size_t) n < size - pos ? (size_t) n : size - pos - 1;
+	}
+
+	out[pos] = '\0';
+	return (int) strnlen(out, pos);
+}
+
+/* Renders the lines with a format in a logger's buffer, so that they no longer
+ * depend on formats ls knows. Rendered lines take more room than encoded
+ * ones; if they do not all fit in the buffer, the ones that do are sent. */
+static int render_buffered(open_logger_t* ol) {
+	char text[MAX_MESSAGE_LEN + 1];
+	size_t pos = 0;
+	size_t len = 0;
+	int ret = OK;
+
+	char* out = malloc(ol->buf_size);
+	if (!out) {
+		return -ENOMEM;
+	}
+
+	while (ol->buf_len - pos >= sizeof(ls_batch_line_t)) {
+		ls_batch_line_t line;
+		const char* payload = ol->buf + pos + sizeof(line);
+
+		memcpy(&line, ol->buf + pos, sizeof(line));
+		pos += sizeof(line) + LS_BATCH_ALIGN(line.message_len);
+
+		if (line.format_id) {
+			interned_format_t* f = find_interned_id(line.format_id);
+			int n = f ? render_args(f, payload, line.message_len, text, sizeof(text)) : -1;
+			if (n < 0) {
+				continue;
+			}
+
+			if (n > (int) (ol->buf_size - sizeof(line))) {
+				n = ol->buf_size - sizeof(line);
+			}
+			line.format_id = 0;
+			line.message_len = (uint16_t) n;
+			payload = text;
+		}
+
+		size_t need = sizeof(line) + LS_BATCH_ALIGN(line.message_len);
+		if (need > ol->buf_size - len) {
+			int ret_send = send_batch(ol->handle, out, len, &ol->filtered, &ol->sampled);
+			if (ret == OK) {
+				ret = ret_send;
+			}
+			len = 0;
+		}
+
+		memcpy(out + len, &line, sizeof(line));
+		memcpy(out + len + sizeof(line), payload, line.message_len);
+		len += need;
+	}
+
+	free(ol->buf);
+	ol->buf = out;
+	ol->buf_len = len;
+
+	return ret;
+}
+
+/* Forgets what ls said about formats, once it no longer knows them. Lines
+ * buffered with a format are rendered first, while their formats are still
+ * known here. */
+static void forget_formats() {
+	int i;
+
+	for (i = 0; i < MAX_OPEN_LOGGERS; i++) {
+		if (open_loggers[i].buf_len > 0) {
+			render_buffered(&open_loggers[i]);
+		}
+	}
+
+	memset(interned_formats, 0, sizeof(interned_formats));
+}
+
+int minix_ls_would_log(const char* logger, minix_ls_log_level_t message_level) {
+	open_logger_t* ol = find_open_logger(logger);
+
+	if (ol && message_level < ol->severity) {
+		ol->filtered++;
+		return 0;
+	}
+
+	return 1;
+}
+
+int minix_ls_writef(const char* logger, minix_ls_log_level_t message_level, const char* format, ...) {
+	char payload[MAX_MESSAGE_LEN + 1];
+	interned_format_t* f;
+	va_list ap;
+	int len;
+
+	if (strlen(logger) >= LS_IPC_LOGGER_MAX_NAME_LEN - 1 ||
+			message_level < MINIX_LS_LEVEL_TRACE ||
+			message_level > MINIX_LS_LEVEL_WARN) {
+		return -EINVAL;
+	}
+
+	/* Nothing is formatted for lines that are thrown away. */
+	open_logger_t* ol = find_open_logger(logger);
+	if (ol && !keep_line(ol, message_level)) {
+		return OK;
+	}
+
+	if (ol && (f = intern_format(format)) && f->id > 0) {
+		va_start(ap, format);
+		len = encode_args(f, ap, payload);
+		va_end(ap);
+
+		if (len >= 0) {
+			int ret = send_line(ol, logger, payload, len, message_level, f->id);
+			if (ret != LS_ERR_NO_SUCH_FORMAT) {
+				return ret;
+			}
+
+			/* ls has been restarted, or the handle went stale. */
+			forget_formats();
+			ol = find_open_logger(logger);
+		}
+	}
+
+	va_start(ap, format);
+	len = vsnprintf(payload, sizeof(payload), format, ap);
+	va_end(ap);
+
+	if (len < 0) {
+		return -EINVAL;
+	} else if (len > MAX_MESSAGE_LEN) {
+		len = MAX_MESSAGE_LEN;
+	}
+
+	/* A NUL, e.g. from %c, would have ls take the rest for kv fields. */
+	len = strnlen(payload, len);
+
+	return send_line(ol, logger, payload, len, message_level, 0);
 }
 
 int minix_ls_set_logger_level(const char* logger, minix_ls_log_level_t new_level) {
@@ -73,6 +1188,49 @@ int minix_ls_set_logger_level(const char* logger, minix_ls_log_level_t new_level
 	return wrap_syscall(LS_SET_SEVERITY, &m);
 }
 
+int minix_ls_get_stats(const char* logger, minix_ls_stats_t* stats) {
+	if (strlen(logger) >= LS_IPC_LOGGER_MAX_NAME_LEN - 1) {
+		return -EINVAL;
+	}
+
+	message m;
+	memset(&m, 0, sizeof(m));
+	strncpy(m.m_ls_get_stats.logger, logger, LS_IPC_LOGGER_MAX_NAME_LEN);
+	m.m_ls_get_stats.stats = stats;
+	return wrap_syscall(LS_GET_STATS, &m);
+}
+
+#define MAX_TEMPLATE_NAME_LEN               32
+#define MAX_OVERRIDES_LEN                   1024
+
+int minix_ls_create_logger(const char* logger, const char* template_name, const char* overrides) {
+	static char spec_buf[MAX_TEMPLATE_NAME_LEN + MAX_OVERRIDES_LEN];
+
+	if (strlen(logger) >= LS_IPC_LOGGER_MAX_NAME_LEN - 1) {
+		return -EINVAL;
+	}
+
+	size_t template_len = strlen(template_name);
+	size_t overrides_len = overrides ? strlen(overrides) : 0;
+	if (template_len == 0 || template_len > MAX_TEMPLATE_NAME_LEN - 1 ||
+			overrides_len > MAX_OVERRIDES_LEN) {
+		return -EINVAL;
+	}
+
+	memcpy(spec_buf, template_name, template_len);
+	if (overrides_len) {
+		memcpy(spec_buf + template_len, overrides, overrides_len);
+	}
+
+	message m;
+	memset(&m, 0, sizeof(m));
+	strncpy(m.m_ls_create_logger.logger, logger, LS_IPC_LOGGER_MAX_NAME_LEN);
+	m.m_ls_create_logger.spec = spec_buf;
+	m.m_ls_create_logger.template_len = (uint16_t) template_len;
+	m.m_ls_create_logger.overrides_len = (uint16_t) overrides_len;
+	return wrap_syscall(LS_CREATE_LOGGER, &m);
+}
+
 #define MAX_LOGGERS_LEN                     1024
 
 int minix_ls_clear_logs(const char* loggers) {
@@ -137,3 +1295,51 @@ int minix_ls_clear_logs(const char* loggers) {
 
 	return ret;
 }
+
+int minix_ls_subscribe(const char* logger, minix_ls_log_level_t min_level) {
+	if (strlen(logger) >= LS_IPC_LOGGER_MAX_NAME_LEN - 1) {
+		return -EINVAL;
+	}
+
+	message m;
+	memset(&m, 0, sizeof(m));
+	strncpy(m.m_ls_subscribe.logger, logger, LS_IPC_LOGGER_MAX_NAME_LEN);
+	m.m_ls_subscribe.severity = (int) min_level;
+
+	int ret = wrap_syscall(LS_SUBSCRIBE, &m);
+	if (ret != OK) {
+		return ret;
+	}
+
+	return m.m_ls_subscribe_reply.subscription;
+}
+
+int minix_ls_read_subscription(int subscription, void* buf, size_t buf_len, unsigned int* dropped) {
+	if (buf_len < MINIX_LS_MAX_RECORD_LEN) {
+		return -EINVAL;
+	}
+
+	message m;
+	memset(&m, 0, sizeof(m));
+	m.m_ls_read_subscription.subscription = subscription;
+	m.m_ls_read_subscription.buf = buf;
+	m.m_ls_read_subscription.buf_len = buf_len > INT_MAX ? INT_MAX : buf_len;
+
+	int ret = wrap_syscall(LS_READ_SUBSCRIPTION, &m);
+	if (ret != OK) {
+		return ret;
+	}
+
+	if (dropped) {
+		*dropped = m.m_ls_read_subscription_reply.dropped;
+	}
+
+	return m.m_ls_read_subscription_reply.len;
+}
+
+int minix_ls_unsubscribe(int subscription) {
+	message m;
+	memset(&m, 0, sizeof(m));
+	m.m_ls_unsubscribe.subscription = subscription;
+	return wrap_syscall(LS_UNSUBSCRIBE, &m);
+}
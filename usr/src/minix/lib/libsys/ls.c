@@ -0,0 +1,68 @@
+#include <minix/sysutil.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "syslib.h"
+
+/* Logging for system processes through ls. Unlike the minix_ls_* calls in
+ * libc, the text of a line is handed to ls through a grant, so ls never needs
+ * access to the caller's address space. */
+
+int ls_start_log(const char *logger, int *handle)
+{
+	message m;
+	int r;
+
+	if (strlen(logger) >= LS_IPC_LOGGER_MAX_NAME_LEN)
+		return EINVAL;
+
+	memset(&m, 0, sizeof(m));
+	strncpy(m.m_ls_start_log.logger, logger, LS_IPC_LOGGER_MAX_NAME_LEN);
+
+	if ((r = _taskcall(LS_PROC_NR, LS_START_LOG, &m)) != OK)
+		return r;
+
+	*handle = m.m_ls_start_log_reply.handle;
+	return OK;
+}
+
+int ls_write_grant(int handle, int level, const char *msg, size_t len)
+{
+	cp_grant_id_t grant;
+	message m;
+	int r;
+
+	if (len > UINT16_MAX)
+		return EINVAL;
+
+	grant = cpf_grant_direct(LS_PROC_NR, (vir_bytes) msg, len, CPF_READ);
+	if (!GRANT_VALID(grant))
+		return ENOMEM;
+
+	memset(&m, 0, sizeof(m));
+	read_tsc_64(&m.m_ls_write.tsc);
+	m.m_ls_write.handle = handle;
+	m.m_ls_write.severity = level;
+	m.m_ls_write.message_len = len;
+	m.m_ls_write.flags = LS_WRITE_GRANT;
+	m.m_ls_write.grant = grant;
+
+	/* ls has copied the line by the time it replies. */
+	r = _taskcall(LS_PROC_NR, LS_WRITE, &m);
+
+	cpf_revoke(grant);
+	return r;
+}
+
+int ls_close_log(const char *logger)
+{
+	message m;
+
+	if (strlen(logger) >= LS_IPC_LOGGER_MAX_NAME_LEN)
+		return EINVAL;
+
+	memset(&m, 0, sizeof(m));
+	strncpy(m.m_ls_close_log.logger, logger, LS_IPC_LOGGER_MAX_NAME_LEN);
+
+	return _taskcall(LS_PROC_NR, LS_CLOSE_LOG, &m);
+}
@@ -0,0 +1,69 @@
+#include "proto.h"
+#include <minix/sysutil.h>
+#include <minix/minlib.h>
+#include "mini-printf.h"
+
+/* Timestamps for the %t, %T and %e format fields. The clock is read once,
+ * when ls is first initialized, and paired with a TSC reading; after that the
+ * time of a line is worked out from the TSC alone, so stamping a line costs
+ * neither a kernel call nor IPC. The uptime anchor is never moved, which keeps %T
+ * monotonic across config reloads. */
+
+u64_t g_clock_tsc;
+u64_t g_clock_uptime_us;
+u64_t g_clock_epoch_us;
+u32_t g_clock_mhz;
+
+int clock_init() {
+	clock_t ticks, realtime;
+	time_t boottime;
+	u32_t hz;
+	int ret;
+
+	if (g_clock_mhz) {
+		return OK;
+	}
+
+	if ((ret = getuptime(&ticks, &realtime, &boottime)) != OK) {
+		LS_LOG_PRINTF(warn, "Failed to get uptime: %d", ret);
+		return LS_ERR_EXTERNAL;
+	}
+	read_tsc_64(&g_clock_tsc);
+
+	hz = sys_hz();
+	g_clock_uptime_us = (u64_t)ticks * 1000000 / hz;
+	g_clock_epoch_us = (u64_t)boottime * 1000000 + (u64_t)realtime * 1000000 / hz;
+
+	/* tsc_64_to_micros() only covers a bit over an hour, so the same
+	 * calibration is applied to the full 64-bit difference here. */
+	g_clock_mhz = tsc_get_khz() / 1000;
+	if (!g_clock_mhz) {
+		g_clock_mhz = 1;
+	}
+
+	return OK;
+}
+
+/* Handed to clients, so they can tell how much time has passed from their
+ * own TSC readings. */
+u32_t clock_tsc_khz() {
+	return g_clock_mhz * 1000;
+}
+
+/* Microseconds between the anchor and the given TSC reading. Readings taken
+ * on another CPU may be slightly behind the anchor; those count as zero. */
+u64_t clock_since_anchor(u64_t tsc) {
+	if (tsc < g_clock_tsc) {
+		return 0;
+	}
+
+	return (tsc - g_clock_tsc) / g_clock_mhz;
+}
+
+u64_t clock_uptime_us(u64_t tsc) {
+	return g_clock_uptime_us + clock_since_anchor(tsc);
+}
+
+u64_t clock_epoch_ms(u64_t tsc) {
+	return (g_clock_epoch_us + clock_since_anchor(tsc)) / 1000;
+}
@@ -4,242 +4,275 @@
 #include <malloc.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include "bufio.h"
+#include <sys/stat.h>
 #include "mini-printf.h"
-#include <assert.h>
 #include <sys/errno.h>
-
-#define MAX_VALUE_LEN            2048
-
-typedef enum parser_state_kind_t {
-	PARSE_LOGGER_KEYWORD,
-	PARSE_LOGGER_NAME,
-	PARSE_OPEN_BRACE,
-	PARSE_OPEN_BRACE_NEWLINE,
-	PARSE_CONFIG_OPTION_NAME,
-	PARSE_CONFIG_OPTION_EQUALS,
-	PARSE_CONFIG_VALUE
-} parser_state_kind_t;
-
-typedef enum parser_result_kind_t {
-	PARSE_OK,
-	PARSE_GOT_LOGGER,
-	PARSE_ERROR
-} parser_result_kind_t;
-
-typedef struct parser_result_t {
-	parser_result_kind_t kind;
-	int error_line_no;
-	int error_char_no;
-	ls_logger_t* logger;
-} parser_result_t;
-
-typedef struct parser_state_t {
-	parser_state_kind_t kind;
+#include <stddef.h>
+#include <syslog.h>
+
+/* The whole config file is read into memory with as few read() calls as
+ * possible, and then scanned in place. Tokens are never copied out of the
+ * buffer until they are stored in the logger they belong to. */
+#define READ_CHUNK_SIZE          65536
+
+#define OPT_SEEN_DESTINATION     0x01
+#define OPT_SEEN_SEVERITY        0x02
+#define OPT_SEEN_FORMAT          0x04
+#define OPT_SEEN_FILENAME        0x08
+#define OPT_SEEN_APPEND          0x10
+#define OPT_SEEN_RATE            0x20
+#define OPT_SEEN_BURST           0x40
+#define OPT_SEEN_DEDUP           0x80
+#define OPT_SEEN_SAMPLE          0x100
+#define OPT_SEEN_OVERFLOW        0x200
+#define OPT_SEEN_HIGH_WATERMARK  0x400
+#define OPT_SEEN_LOW_WATERMARK   0x800
+#define OPT_SEEN_FACILITY        0x1000
+#define OPT_SEEN_BUFFER          0x2000
+#define OPT_SEEN_COMPRESS        0x4000
+#define OPT_SEEN_INDEX           0x8000
+
+typedef struct token_t {
+	const char* start;
+	int len;
+} token_t;
+
+typedef struct scanner_t {
+	const char* pos;
+	const char* end;
+	const char* line_start;
 	int line_no;
-	int char_no;
-
-	int consume_offset;
+} scanner_t;
+
+typedef struct option_desc_t {
+	const char* name;
+	int seen_flag;
+	int (*set)(const token_t* value, ls_logger_t* logger);
+} option_desc_t;
+
+typedef struct sink_option_desc_t {
+	const char* name;
+	int seen_flag;
+	int (*set)(const token_t* value, const ls_logger_t* logger, ls_sink_t* sink);
+} sink_option_desc_t;
+
+typedef struct setting_desc_t {
+	const char* name;
+	size_t offset;
+} setting_desc_t;
+
+int token_is(const token_t* tok, const char* literal) {
+	int len = (int)strlen(literal);
+	return tok->len == len && memcmp(tok->start, literal, len) == 0;
+}
 
-	char curr_value[MAX_VALUE_LEN];
-	char option_name[MAX_VALUE_LEN];
-	int curr_value_offset;
+int is_white(char ch) {
+	return ch == ' ' || ch == '\t' || ch == '\r';
+}
 
-	int did_set_filename;
-	int did_set_append;
-	int did_set_type;
-	int did_set_format;
+int is_allowed_in_logger_name(char ch) {
+	return
+		(ch >= 'A' && ch <= 'Z') ||
+		(ch >= 'a' && ch <= 'z') ||
+		(ch >= '0' && ch <= '9') ||
+		(ch == '_');
+}
 
-	ls_logger_t current_logger;
-} parser_state_t;
+int is_allowed_in_config_option_name(char ch) {
+	return
+		(ch >= 'a' && ch <= 'z') ||
+		(ch >= '0' && ch <= '9') ||
+		(ch == '_') || (ch == '.');
+}
 
-parser_state_t* parse_init() {
-	parser_state_t *state = (parser_state_t*)malloc(sizeof(parser_state_t));
-	if (!state) {
-		return NULL;
+void scan_skip_white(scanner_t* s) {
+	while (s->pos < s->end && is_white(*s->pos)) {
+		s->pos++;
 	}
+}
 
-	state->kind = PARSE_LOGGER_KEYWORD;
-	state->line_no = 1;
-	state->char_no = 1;
-	state->consume_offset = 0;
-	state->curr_value_offset = 0;
-	state->did_set_filename = FALSE;
-	state->did_set_append = FALSE;
-	state->did_set_type = FALSE;
-	state->did_set_format = FALSE;
+void scan_skip_white_and_newlines(scanner_t* s) {
+	while (s->pos < s->end) {
+		if (*s->pos == '\n') {
+			s->line_no++;
+			s->line_start = s->pos + 1;
+		} else if (!is_white(*s->pos)) {
+			break;
+		}
 
-	memset(&state->current_logger, sizeof(ls_logger_t), 0);
+		s->pos++;
+	}
+}
 
-	return state;
+int scan_peek(scanner_t* s) {
+	return s->pos < s->end ? *s->pos : -1;
 }
 
-void parse_destroy(parser_state_t* state) {
-	if (state) {
-		free(state);
+void scan_word(scanner_t* s, int (*allowed)(char), token_t* tok) {
+	tok->start = s->pos;
+	while (s->pos < s->end && allowed(*s->pos)) {
+		s->pos++;
 	}
+	tok->len = (int)(s->pos - tok->start);
 }
 
-// buf needs to be at least 3 bytes long.
-char* translate_char(char ch, char* buf) {
-	switch (ch) {
-	case '\n': strncpy(buf, "\\n", 3); break;
-	case '\t': strncpy(buf, "\\t", 3); break;
-	case '\r': strncpy(buf, "\\r", 3); break;
-	default:
-		buf[0] = ch; buf[1] = '\0';
-		break;
+/* Reads everything up to (but not including) the end of the line, skipping
+ * leading whitespace. The newline itself is consumed. */
+void scan_rest_of_line(scanner_t* s, token_t* tok) {
+	scan_skip_white(s);
+
+	tok->start = s->pos;
+	while (s->pos < s->end && *s->pos != '\n') {
+		s->pos++;
 	}
+	tok->len = (int)(s->pos - tok->start);
 
-	return buf;
+	if (tok->len > 0 && tok->start[tok->len - 1] == '\r') {
+		tok->len--;
+	}
+
+	if (s->pos < s->end) {
+		s->pos++;
+		s->line_no++;
+		s->line_start = s->pos;
+	}
 }
 
-int parse_consumption(parser_state_t* state, const char* literal, char ch, parser_state_kind_t next) {
-	if (literal[state->consume_offset] == ch) {
-		state->consume_offset++;
-		if (state->consume_offset >= strlen(literal)) {
-			state->kind = next;
-			state->consume_offset = 0;
-			state->curr_value_offset = 0;
-		}
+void scan_error(scanner_t* s, const char* what) {
+	LS_LOG_PRINTF(warn, "Parse error on line %d char %d: %s", s->line_no, (int)(s->pos - s->line_start) + 1, what);
+}
 
-		return 0;
-	} else {
-		char chbuf[16];
-		LS_LOG_PRINTF(warn, "Unexpected character '%s' while consuming literal '%s'", translate_char(ch, chbuf), literal);
+int copy_token(const token_t* tok, char* dst, int dst_len, const char* what) {
+	if (tok->len > dst_len - 1) {
+		LS_LOG_PRINTF(warn, "Logger %s string has length %d, which is longer than maximum allowed (%d)", what, tok->len, dst_len - 1);
 		return -1;
 	}
-}
 
-int is_white(char ch) {
-	return ch == ' ' || ch == '\t';
-}
-
-#define TRY_PARSE(x) \
-	do { \
-		int ret = (x); \
-		if (ret < 0) { \
-			set_parse_error(&res, state); \
-		} else { \
-			set_parse_ok(&res); \
-		} \
-		\
-		return res; \
-	} while (0)
-
-int is_whitespace_invariant(parser_state_t* state) {
-	// We are reading a logger name and we have consumed at least one character
-	// of it. Mustn't consume whitespace. The logger name state will stop
-	// reading the name when it encounters a whitespace char.
-	if (state->kind == PARSE_LOGGER_NAME && state->curr_value_offset > 0) {
-		return FALSE;
-	}
+	memcpy(dst, tok->start, tok->len);
+	dst[tok->len] = '\0';
 
-	// We are reading the `logger` keyword. Similarly.
-	if (state->kind == PARSE_LOGGER_KEYWORD && state->consume_offset > 0) {
-		return FALSE;
-	}
+	return 0;
+}
 
-	// We have started reading a config option.
-	if (state->kind == PARSE_CONFIG_OPTION_NAME && state->curr_value_offset > 0) {
-		return FALSE;
+int parse_uint(const token_t* tok, int* value) {
+	int n = 0;
+
+	if (tok->len == 0 || tok->len > 9) {
+		return -1;
 	}
 
-	// We have started reading a config value. This is terminated only by a newline,
-	// and all whitespace has to be included.
-	if (state->kind == PARSE_CONFIG_VALUE && state->curr_value_offset > 0) {
-		return FALSE;
+	for (int i = 0; i < tok->len; i++) {
+		if (tok->start[i] < '0' || tok->start[i] > '9') {
+			return -1;
+		}
+		n = n * 10 + (tok->start[i] - '0');
 	}
 
-	// In all other cases, whitespace needs to be skipped.
-	return TRUE;
+	*value = n;
+	return 0;
 }
 
-int is_newline_invariant(parser_state_t* state) {
-	// We are waiting for the opening brace after the logger name.
-	if (state->kind == PARSE_OPEN_BRACE && state->consume_offset == 0) {
-		return TRUE;
+int set_sink_dest_type(const token_t* dest_type, const ls_logger_t* logger, ls_sink_t* sink) {
+	if (token_is(dest_type, "file")) {
+		sink->dest_type = LS_DESTINATION_FILE;
+	} else if (token_is(dest_type, "stdout")) {
+		sink->dest_type = LS_DESTINATION_STDOUT;
+	} else if (token_is(dest_type, "stderr")) {
+		sink->dest_type = LS_DESTINATION_STDERR;
+	} else if (token_is(dest_type, "syslog")) {
+		sink->dest_type = LS_DESTINATION_SYSLOG;
+	} else {
+		LS_LOG_PRINTF(warn, "Invalid logger destination for logger '%s'", logger->name);
+		LS_LOG_PUTS  (warn, "    (expected one of 'file', 'stdout', 'stderr', 'syslog')");
+		return -1;
 	}
 
-	// We are waiting for the first char of the logger keyword.
-	if (state->kind == PARSE_LOGGER_KEYWORD && state->consume_offset == 0) {
-		return TRUE;
-	}
+	return 0;
+}
 
-	// We are waiting for an option name. This just means an empty line, which we
-	// allow.
-	if (state->kind == PARSE_CONFIG_OPTION_NAME && state->curr_value_offset == 0) {
-		return TRUE;
+int parse_severity(const token_t* severity, ls_severity_level_t* value, const char* logger_name) {
+	if (token_is(severity, "trace")) {
+		*value = LS_SEV_TRACE;
+	} else if (token_is(severity, "debug")) {
+		*value = LS_SEV_DEBUG;
+	} else if (token_is(severity, "info")) {
+		*value = LS_SEV_INFO;
+	} else if (token_is(severity, "warn")) {
+		*value = LS_SEV_WARN;
+	} else {
+		LS_LOG_PRINTF(warn, "Invalid logger severity for logger '%s'", logger_name);
+		LS_LOG_PUTS  (warn, "    (expected one of 'trace', 'debug', 'info', 'warn')");
+		return -1;
 	}
 
-	return FALSE;
+	return 0;
 }
 
-int is_allowed_in_logger_name(char ch) {
-	return
-		(ch >= 'A' && ch <= 'Z') ||
-		(ch >= 'a' && ch <= 'z') ||
-		(ch >= '0' && ch <= '9') ||
-		(ch == '_');
+int set_logger_severity(const token_t* severity, ls_logger_t* logger) {
+	return parse_severity(severity, &logger->severity, logger->name);
 }
 
-int is_allowed_in_config_option_name(char ch) {
-	return
-		(ch >= 'a' && ch <= 'z') ||
-		(ch >= '0' && ch <= '9');
+int set_sink_severity(const token_t* severity, const ls_logger_t* logger, ls_sink_t* sink) {
+	return parse_severity(severity, &sink->severity, logger->name);
 }
 
-void set_parse_error(parser_result_t* res, parser_state_t* state) {
-	res->kind = PARSE_ERROR;
-	res->error_line_no = state->line_no;
-	res->error_char_no = state->char_no;
+int parse_bool(const token_t* tok, int* value) {
+	if (token_is(tok, "true")) {
+		*value = TRUE;
+	} else if (token_is(tok, "false")) {
+		*value = FALSE;
+	} else {
+		return -1;
+	}
+
+	return 0;
 }
 
-void set_parse_ok(parser_result_t* res) {
-	res->kind = PARSE_OK;
+int set_sink_append(const token_t* append, const ls_logger_t* logger, ls_sink_t* sink) {
+	if (parse_bool(append, &sink->append) != 0) {
+		LS_LOG_PRINTF(warn, "Invalid append value for logger '%s'", logger->name);
+		LS_LOG_PUTS  (warn, "    (expected 'true' or 'false')");
+		return -1;
+	}
+
+	return 0;
 }
 
-int set_logger_dest_type(const char* dest_type, ls_logger_t* logger) {
-	if (strcmp(dest_type, "file") == 0) {
-		logger->dest_type = LS_DESTINATION_FILE;
-	} else if (strcmp(dest_type, "stdout") == 0) {
-		logger->dest_type = LS_DESTINATION_STDOUT;
-	} else if (strcmp(dest_type, "stderr") == 0) {
-		logger->dest_type = LS_DESTINATION_STDERR;
-	} else {
-		LS_LOG_PRINTF(warn, "Invalid logger destination '%s' for logger '%s'", dest_type, logger->name);
-		LS_LOG_PUTS  (warn, "    (expected one of 'file', 'stdout', 'stderr')");
+int set_sink_buffer(const token_t* buffer, const ls_logger_t* logger, ls_sink_t* sink) {
+	if (parse_uint(buffer, &sink->buffer) != 0 || sink->buffer > LS_MAX_FILE_BUFSIZE) {
+		LS_LOG_PRINTF(warn, "Invalid buffer for logger '%s' (expected at most %d bytes)", logger->name, LS_MAX_FILE_BUFSIZE);
 		return -1;
 	}
 
 	return 0;
 }
 
-int set_logger_severity(const char* severity, ls_logger_t* logger) {
-	if (strcmp(severity, "trace") == 0) {
-		logger->severity = LS_SEV_TRACE;
-	} else if (strcmp(severity, "debug") == 0) {
-		logger->severity = LS_SEV_DEBUG;
-	} else if (strcmp(severity, "info") == 0) {
-		logger->severity = LS_SEV_INFO;
-	} else if (strcmp(severity, "warn") == 0) {
-		logger->severity = LS_SEV_WARN;
+int set_sink_compress(const token_t* compress, const ls_logger_t* logger, ls_sink_t* sink) {
+	if (token_is(compress, "none")) {
+		sink->compress = LS_COMPRESS_NONE;
+	} else if (token_is(compress, "lz")) {
+		sink->compress = LS_COMPRESS_LZ;
 	} else {
-		LS_LOG_PRINTF(warn, "Invalid logger severity '%s' for logger '%s'", severity, logger->name);
-		LS_LOG_PUTS  (warn, "    (expected one of 'trace', 'debug', 'info', 'warn')");
+		LS_LOG_PRINTF(warn, "Invalid compress value for logger '%s'", logger->name);
+		LS_LOG_PUTS  (warn, "    (expected 'none' or 'lz')");
 		return -1;
 	}
 
 	return 0;
 }
 
-int set_logger_append(const char* append, ls_logger_t* logger) {
-	if (strcmp(append, "true") == 0) {
-		logger->append = TRUE;
-	} else if (strcmp(append, "false") == 0) {
-		logger->append = FALSE;
-	} else {
-		LS_LOG_PRINTF(warn, "Invalid append value '%s' for logger '%s'", append, logger->name);
+int set_sink_index(const token_t* index, const ls_logger_t* logger, ls_sink_t* sink) {
+	if (parse_uint(index, &sink->index) != 0) {
+		LS_LOG_PRINTF(warn, "Invalid index for logger '%s' (expected a number of lines)", logger->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+int set_logger_dedup(const token_t* dedup, ls_logger_t* logger) {
+	if (parse_bool(dedup, &logger->dedup) != 0) {
+		LS_LOG_PRINTF(warn, "Invalid dedup value for logger '%s'", logger->name);
 		LS_LOG_PUTS  (warn, "    (expected 'true' or 'false')");
 		return -1;
 	}
@@ -247,325 +280,789 @@ int set_logger_append(const char* append, ls_logger_t* logger) {
 	return 0;
 }
 
-const char* trim(const char* str) {
-	while (*str && is_white(*str)) {
-		str++;
+int set_logger_rate(const token_t* rate, ls_logger_t* logger) {
+	if (parse_uint(rate, &logger->rate) != 0) {
+		LS_LOG_PRINTF(warn, "Invalid rate for logger '%s' (expected lines per second)", logger->name);
+		return -1;
 	}
 
-	return str;
+	return 0;
 }
 
-int set_logger_option(const char* option_name, const char* option_value, ls_logger_t* logger, parser_state_t* state) {
-	option_name = trim(option_name);
-	option_value = trim(option_value);
+int set_logger_burst(const token_t* burst, ls_logger_t* logger) {
+	if (parse_uint(burst, &logger->burst) != 0) {
+		LS_LOG_PRINTF(warn, "Invalid burst for logger '%s' (expected a number of lines)", logger->name);
+		return -1;
+	}
 
-	if (strcmp(option_name, "destination") == 0) {
-		state->did_set_type = TRUE;
-		return set_logger_dest_type(option_value, logger);
-	} else if (strcmp(option_name, "severity") == 0) {
-		return set_logger_severity(option_value, logger);
-	} else if (strcmp(option_name, "format") == 0) {
-		state->did_set_format = TRUE;
-		size_t len = strlen(option_value);
-		if (len > LS_MAX_LOGGER_FORMAT_LEN - 1) {
-			LS_LOG_PRINTF(warn, "Logger format string has length %d, which is longer than maximum allowed (%d)", (int)len, LS_MAX_LOGGER_FORMAT_LEN - 1);
+	return 0;
+}
 
-			return -1;
-		}
+/* Sampling rates are written as `1/N`; plain `1` keeps every line. */
+int set_logger_sample(const token_t* value, ls_logger_t* logger, ls_severity_level_t severity) {
+	token_t num = *value, den;
+	int n = 0, d = 1;
 
-		memcpy(logger->format, option_value, len + 1);
-		logger->format[LS_MAX_LOGGER_FORMAT_LEN - 1] = '\0';
-	} else if (strcmp(option_name, "filename") == 0) {
-		state->did_set_filename = TRUE;
-		size_t len = strlen(option_value);
-		if (len > LS_MAX_LOGGER_LOGFILE_PATH_LEN - 1) {
-			LS_LOG_PRINTF(warn, "Logger destination filename string has length %d, which is longer than maximum allowed (%d)", (int)len, LS_MAX_LOGGER_LOGFILE_PATH_LEN - 1);
+	const char* slash = memchr(value->start, '/', value->len);
+	if (slash) {
+		num.len = (int)(slash - value->start);
+		den.start = slash + 1;
+		den.len = value->len - num.len - 1;
+	}
 
-			return -1;
-		}
+	if (parse_uint(&num, &n) != 0 || n != 1 ||
+			(slash && parse_uint(&den, &d) != 0) ||
+			d < 1 || d > LS_MAX_SAMPLE_EVERY) {
+		LS_LOG_PRINTF(warn, "Invalid sampling rate for logger '%s'", logger->name);
+		LS_LOG_PRINTF(warn, "    (expected '1/N', with N at most %d)", LS_MAX_SAMPLE_EVERY);
+		return -1;
+	}
+
+	logger->sample_every[severity] = d;
+	return 0;
+}
+
+int set_logger_sample_trace(const token_t* value, ls_logger_t* logger) {
+	return set_logger_sample(value, logger, LS_SEV_TRACE);
+}
+
+int set_logger_sample_debug(const token_t* value, ls_logger_t* logger) {
+	return set_logger_sample(value, logger, LS_SEV_DEBUG);
+}
+
+int set_logger_sample_info(const token_t* value, ls_logger_t* logger) {
+	return set_logger_sample(value, logger, LS_SEV_INFO);
+}
 
-		memcpy(logger->dest_filename, option_value, len + 1);
-		logger->dest_filename[LS_MAX_LOGGER_LOGFILE_PATH_LEN - 1] = '\0';
-	} else if (strcmp(option_name, "append") == 0) {
-		state->did_set_append = TRUE;
-		return set_logger_append(option_value, logger);
+int set_logger_sample_warn(const token_t* value, ls_logger_t* logger) {
+	return set_logger_sample(value, logger, LS_SEV_WARN);
+}
+
+int set_logger_overflow(const token_t* overflow, ls_logger_t* logger) {
+	if (token_is(overflow, "block")) {
+		logger->overflow = LS_OVERFLOW_BLOCK;
+	} else if (token_is(overflow, "drop_newest")) {
+		logger->overflow = LS_OVERFLOW_DROP_NEWEST;
+	} else if (token_is(overflow, "drop_oldest")) {
+		logger->overflow = LS_OVERFLOW_DROP_OLDEST;
 	} else {
-		LS_LOG_PRINTF(warn, "Invalid option name '%s' for logger '%s'", option_name, logger->name);
-		LS_LOG_PUTS  (warn, "    expected one of 'destination', 'filename', 'severity',");
-		LS_LOG_PUTS  (warn, "                    'format', 'append'");
+		LS_LOG_PRINTF(warn, "Invalid overflow policy for logger '%s'", logger->name);
+		LS_LOG_PUTS  (warn, "    (expected one of 'block', 'drop_newest', 'drop_oldest')");
+		return -1;
+	}
 
+	return 0;
+}
+
+int set_logger_high_watermark(const token_t* value, ls_logger_t* logger) {
+	if (parse_uint(value, &logger->high_watermark) != 0) {
+		LS_LOG_PRINTF(warn, "Invalid high_watermark for logger '%s' (expected a number of bytes)", logger->name);
 		return -1;
 	}
 
 	return 0;
 }
 
-parser_result_t parse_advance(parser_state_t* state, char ch, char lookahead) {
-	if (ch == '\n') {
-		/* Just so we can show a reasonable error message. */
-		state->line_no++;
-		state->char_no = 0;
-	} else {
-		state->char_no++;
+int set_logger_low_watermark(const token_t* value, ls_logger_t* logger) {
+	if (parse_uint(value, &logger->low_watermark) != 0) {
+		LS_LOG_PRINTF(warn, "Invalid low_watermark for logger '%s' (expected a number of bytes)", logger->name);
+		return -1;
 	}
 
-	parser_result_t res;
-	if ((is_white(ch) && is_whitespace_invariant(state)) ||
-			(ch == '\n' && is_newline_invariant(state))) {
-		set_parse_ok(&res);
-		return res;
+	return 0;
+}
+
+typedef struct facility_desc_t {
+	const char* name;
+	int facility;
+} facility_desc_t;
+
+const facility_desc_t g_facilities[] = {
+	{ "user",   LOG_USER },
+	{ "daemon", LOG_DAEMON },
+	{ "local0", LOG_LOCAL0 },
+	{ "local1", LOG_LOCAL1 },
+	{ "local2", LOG_LOCAL2 },
+	{ "local3", LOG_LOCAL3 },
+	{ "local4", LOG_LOCAL4 },
+	{ "local5", LOG_LOCAL5 },
+	{ "local6", LOG_LOCAL6 },
+	{ "local7", LOG_LOCAL7 },
+	{ NULL,     0 }
+};
+
+int set_sink_facility(const token_t* facility, const ls_logger_t* logger, ls_sink_t* sink) {
+	for (const facility_desc_t* f = g_facilities; f->name; f++) {
+		if (token_is(facility, f->name)) {
+			sink->facility = f->facility;
+			return 0;
+		}
 	}
 
-	switch (state->kind) {
-		/* States which consume fixed strings. */
-		case PARSE_LOGGER_KEYWORD:
-			state->did_set_filename = FALSE;
-			state->did_set_append = FALSE;
-			state->did_set_type = FALSE;
-			state->did_set_format = FALSE;
-			TRY_PARSE(parse_consumption(state, "logger", ch, PARSE_LOGGER_NAME));
-			break;
+	LS_LOG_PRINTF(warn, "Invalid syslog facility for logger '%s'", logger->name);
+	LS_LOG_PUTS  (warn, "    (expected one of 'user', 'daemon', 'local0' to 'local7')");
+	return -1;
+}
 
-		case PARSE_OPEN_BRACE:
-			TRY_PARSE(parse_consumption(state, "{", ch, PARSE_OPEN_BRACE_NEWLINE));
-			break;
+int set_sink_format(const token_t* format, const ls_logger_t* logger, ls_sink_t* sink) {
+	return copy_token(format, sink->format, LS_MAX_LOGGER_FORMAT_LEN, "format");
+}
 
-		case PARSE_OPEN_BRACE_NEWLINE:
-			TRY_PARSE(parse_consumption(state, "\n", ch, PARSE_CONFIG_OPTION_NAME));
-			break;
+int set_sink_filename(const token_t* filename, const ls_logger_t* logger, ls_sink_t* sink) {
+	return copy_token(filename, sink->dest_filename, LS_MAX_LOGGER_LOGFILE_PATH_LEN, "destination filename");
+}
 
-		case PARSE_CONFIG_OPTION_EQUALS:
-			TRY_PARSE(parse_consumption(state, "=", ch, PARSE_CONFIG_VALUE));
-			break;
+/* Options of a single sink. Written without a suffix they apply to the first
+ * sink, with a `.<sink>` suffix to the named one. A plain `severity` is the
+ * logger's own severity, so the sink severity is only reachable with a
+ * suffix. */
+const sink_option_desc_t g_sink_options[] = {
+	{ "destination", OPT_SEEN_DESTINATION, set_sink_dest_type },
+	{ "format",      OPT_SEEN_FORMAT,      set_sink_format },
+	{ "filename",    OPT_SEEN_FILENAME,    set_sink_filename },
+	{ "append",      OPT_SEEN_APPEND,      set_sink_append },
+	{ "buffer",      OPT_SEEN_BUFFER,      set_sink_buffer },
+	{ "compress",    OPT_SEEN_COMPRESS,    set_sink_compress },
+	{ "index",       OPT_SEEN_INDEX,       set_sink_index },
+	{ "severity",    OPT_SEEN_SEVERITY,    set_sink_severity },
+	{ "facility",    OPT_SEEN_FACILITY,    set_sink_facility },
+	{ NULL,          0,                    NULL }
+};
+
+const option_desc_t g_options[] = {
+	{ "severity",    OPT_SEEN_SEVERITY,    set_logger_severity },
+	{ "rate",        OPT_SEEN_RATE,        set_logger_rate },
+	{ "burst",       OPT_SEEN_BURST,       set_logger_burst },
+	{ "dedup",       OPT_SEEN_DEDUP,       set_logger_dedup },
+	{ "sample.trace", OPT_SEEN_SAMPLE,     set_logger_sample_trace },
+	{ "sample.debug", OPT_SEEN_SAMPLE,     set_logger_sample_debug },
+	{ "sample.info", OPT_SEEN_SAMPLE,      set_logger_sample_info },
+	{ "sample.warn", OPT_SEEN_SAMPLE,      set_logger_sample_warn },
+	{ "overflow",    OPT_SEEN_OVERFLOW,    set_logger_overflow },
+	{ "high_watermark", OPT_SEEN_HIGH_WATERMARK, set_logger_high_watermark },
+	{ "low_watermark", OPT_SEEN_LOW_WATERMARK, set_logger_low_watermark },
+	{ NULL,          0,                    NULL }
+};
+
+const setting_desc_t g_settings[] = {
+	{ "max_dynamic_loggers", offsetof(ls_settings_t, max_dynamic_loggers) },
+	{ "sender_rate",         offsetof(ls_settings_t, sender_rate) },
+	{ "sender_burst",        offsetof(ls_settings_t, sender_burst) },
+	{ "max_pending_bytes",   offsetof(ls_settings_t, max_pending_bytes) },
+	{ "preallocate",         offsetof(ls_settings_t, preallocate) },
+	{ NULL,                  0 }
+};
+
+/* Finds the sink with the given name, adding it if there is none yet. */
+ls_sink_t* get_sink(ls_logger_t* logger, const token_t* name) {
+	for (int i = 1; i < logger->nsinks; i++) {
+		if (token_is(name, logger->sinks[i].name)) {
+			return &logger->sinks[i];
+		}
+	}
 
-		/* States which consume values and put them into the buffer. */
-		case PARSE_LOGGER_NAME:
-			if (is_allowed_in_logger_name(ch) &&
-					state->curr_value_offset < LS_MAX_LOGGER_NAME_LEN - 1) {
-
-				state->curr_value[state->curr_value_offset++] = ch;
-				set_parse_ok(&res);
-			} else if (is_white(ch) || ch == '\n') {
-				memset(&state->current_logger, 0, sizeof(ls_logger_t));
-
-				state->curr_value[state->curr_value_offset] = '\0';
-				assert(state->curr_value_offset + 1 <= LS_MAX_LOGGER_NAME_LEN);
-				memcpy(state->current_logger.name, state->curr_value, state->curr_value_offset + 1);
-				LS_LOG_PRINTF(debug, "Logger name = %s", state->curr_value);
-
-				state->kind = PARSE_OPEN_BRACE;
-				state->consume_offset = 0;
-
-				set_parse_ok(&res);
-			} else {
-				char chbuf[16];
-				LS_LOG_PRINTF(warn, "Unexpected char '%s' in logger name", translate_char(ch, chbuf));
-				set_parse_error(&res, state);
-			}
+	if (logger->nsinks >= LS_MAX_SINKS) {
+		LS_LOG_PRINTF(warn, "Logger '%s' has too many destinations (at most %d)", logger->name, LS_MAX_SINKS);
+		return NULL;
+	}
 
-			return res;
-			break;
+	if (name->len == 0 || name->len > LS_MAX_SINK_NAME_LEN - 1 || memchr(name->start, '.', name->len)) {
+		LS_LOG_PRINTF(warn, "Invalid destination name for logger '%s'", logger->name);
+		return NULL;
+	}
 
-		case PARSE_CONFIG_OPTION_NAME:
-			if (is_allowed_in_config_option_name(ch) &&
-					state->curr_value_offset < MAX_VALUE_LEN - 1) {
-
-				state->curr_value[state->curr_value_offset++] = ch;
-				set_parse_ok(&res);
-			} else if (ch == '}') {
-				// TODO: Spit out a new logger
-				res.kind = PARSE_GOT_LOGGER;
-				state->kind = PARSE_LOGGER_KEYWORD;
-				state->consume_offset = 0;
-			} else if ((ch == '=' || is_white(ch)) && state->curr_value_offset > 0) {
-				state->kind = (ch == '=' ? PARSE_CONFIG_VALUE : PARSE_CONFIG_OPTION_EQUALS);
-				state->curr_value[state->curr_value_offset] = '\0';
-				assert(state->curr_value_offset + 1 <= MAX_VALUE_LEN);
-				memcpy(state->option_name, state->curr_value, state->curr_value_offset + 1);
-
-				LS_LOG_PRINTF(debug, "Option name = %s", state->curr_value);
-
-				state->consume_offset = 0;
-				state->curr_value_offset = 0;
-				set_parse_ok(&res);
-			} else {
-				char chbuf[16];
-				LS_LOG_PRINTF(warn, "Unexpected char '%s' in option name", translate_char(ch, chbuf));
-				set_parse_error(&res, state);
-			}
+	ls_sink_t* sink = &logger->sinks[logger->nsinks++];
+	memset(sink, 0, sizeof(ls_sink_t));
+	memcpy(sink->name, name->start, name->len);
+	sink->name[name->len] = '\0';
+	sink->dest_type = LS_DESTINATION_NONE;
 
-			return res;
-			break;
+	return sink;
+}
+
+int set_logger_option(const token_t* option_name, const token_t* option_value, ls_logger_t* logger, int* seen) {
+	for (const option_desc_t* opt = g_options; opt->name; opt++) {
+		if (token_is(option_name, opt->name)) {
+			*seen |= opt->seen_flag;
+			return opt->set(option_value, logger);
+		}
+	}
 
-		case PARSE_CONFIG_VALUE:
-			if (ch == '\n') {
-				state->kind = PARSE_CONFIG_OPTION_NAME;
-				state->curr_value[state->curr_value_offset] = '\0';
-				if (set_logger_option(state->option_name, state->curr_value, &state->current_logger, state) != 0) {
-					set_parse_error(&res, state);
-					return res;
-				}
-
-				state->curr_value_offset = 0;
-				state->consume_offset = 0;
-
-				LS_LOG_PRINTF(debug, "Option value = %s", state->curr_value);
-				set_parse_ok(&res);
-			} else if (state->curr_value_offset < MAX_VALUE_LEN - 1) {
-				state->curr_value[state->curr_value_offset++] = ch;
-				set_parse_ok(&res);
-			} else {
-				char chbuf[16];
-				LS_LOG_PRINTF(warn, "Unexpected char '%s' in option value", translate_char(ch, chbuf));
-				set_parse_error(&res, state);
+	token_t base = *option_name, suffix = { NULL, 0 };
+	const char* dot = memchr(option_name->start, '.', option_name->len);
+	if (dot) {
+		base.len = (int)(dot - option_name->start);
+		suffix.start = dot + 1;
+		suffix.len = option_name->len - base.len - 1;
+	}
+
+	for (const sink_option_desc_t* opt = g_sink_options; opt->name; opt++) {
+		if (token_is(&base, opt->name) && (dot || opt->seen_flag != OPT_SEEN_SEVERITY)) {
+			ls_sink_t* sink = dot ? get_sink(logger, &suffix) : &logger->sinks[0];
+			if (!sink) {
+				return -1;
 			}
 
-			return res;
-			break;
+			if (sink == &logger->sinks[0]) {
+				*seen |= opt->seen_flag;
+			}
+			return opt->set(option_value, logger, sink);
+		}
 	}
-}
 
-int is_logger_valid(parser_state_t* state, ls_logger_list_t* head) {
-	ls_logger_t* l = &state->current_logger;
+	LS_LOG_PRINTF(warn, "Invalid option name for logger '%s'", logger->name);
+	LS_LOG_PUTS  (warn, "    expected one of 'destination', 'filename', 'severity',");
+	LS_LOG_PUTS  (warn, "                    'format', 'append', 'rate', 'burst',");
+	LS_LOG_PUTS  (warn, "                    'dedup', 'sample.<level>', 'overflow',");
+	LS_LOG_PUTS  (warn, "                    'high_watermark', 'low_watermark', 'facility',");
+	LS_LOG_PUTS  (warn, "                    'buffer', 'compress', 'index',");
+	LS_LOG_PUTS  (warn, "                    or '<destination option>.<sink>'");
+
+	return -1;
+}
 
-	if (head) {
-		for (ls_logger_list_t* pl = head; pl; pl = pl->tail) {
-			if (strcmp(l->name, pl->logger.name) == 0) {
-				LS_LOG_PRINTF(warn, "Logger '%s' is already defined", l->name);
+/* Checks the sinks added with suffixed options. They have no defaults to
+ * rely on, so unlike the first sink they are checked by their values. Only
+ * syslog sinks, including the first one, can have a facility. */
+int are_sinks_valid(const ls_logger_t* l) {
+	for (int i = 1; i < l->nsinks; i++) {
+		const ls_sink_t* sink = &l->sinks[i];
+		if (sink->dest_type == LS_DESTINATION_NONE) {
+			LS_LOG_PRINTF(warn, "Logger '%s' has no destination.%s option", l->name, sink->name);
+			return FALSE;
+		} else if (sink->dest_type == LS_DESTINATION_FILE) {
+			if (sink->dest_filename[0] == '\0') {
+				LS_LOG_PRINTF(warn, "Logger '%s' has no filename.%s option, but that destination is a file", l->name, sink->name);
 				return FALSE;
 			}
+		} else if (sink->dest_filename[0] != '\0' || sink->append || sink->buffer || sink->compress || sink->index) {
+			LS_LOG_PRINTF(warn, "Logger '%s' has file options for '%s', but that destination is not a file", l->name, sink->name);
+			return FALSE;
 		}
 	}
 
-	if (!state->did_set_format) {
+	for (int i = 0; i < l->nsinks; i++) {
+		if (l->sinks[i].facility && l->sinks[i].dest_type != LS_DESTINATION_SYSLOG) {
+			LS_LOG_PRINTF(warn, "Logger '%s' has a facility option for a destination that is not syslog", l->name);
+			return FALSE;
+		}
+
+		/* Offsets in the index are into the uncompressed text. */
+		if (l->sinks[i].index && l->sinks[i].compress != LS_COMPRESS_NONE) {
+			LS_LOG_PRINTF(warn, "Logger '%s' has an index option for a compressed destination", l->name);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* Sinks without a format of their own use the first sink's format, which
+ * means that the line is only formatted once for them. Lines go to syslog as
+ * `user` unless a facility is given. */
+void fill_sink_defaults(ls_logger_t* l) {
+	for (int i = 0; i < l->nsinks; i++) {
+		if (i > 0 && l->sinks[i].format[0] == '\0') {
+			memcpy(l->sinks[i].format, l->sinks[0].format, LS_MAX_LOGGER_FORMAT_LEN);
+		}
+
+		if (l->sinks[i].dest_type == LS_DESTINATION_SYSLOG && !l->sinks[i].facility) {
+			l->sinks[i].facility = LOG_USER;
+		}
+	}
+}
+
+int is_logger_valid(const ls_logger_t* l, int seen, const ls_registry_t* reg) {
+	if (registry_find(reg, l->name)) {
+		LS_LOG_PRINTF(warn, "Logger '%s' is already defined", l->name);
+		return FALSE;
+	}
+
+	if (!(seen & OPT_SEEN_FORMAT)) {
 		LS_LOG_PRINTF(warn, "Logger '%s' has no format option, but it is required", l->name);
 		return FALSE;
 	}
 
-	if (!state->did_set_type) {
+	if (!(seen & OPT_SEEN_DESTINATION)) {
 		LS_LOG_PRINTF(warn, "Logger '%s' has no destination option, but it is required", l->name);
 		return FALSE;
 	}
 
-	if (state->did_set_filename && l->dest_type != LS_DESTINATION_FILE) {
+	if ((seen & OPT_SEEN_FILENAME) && l->sinks[0].dest_type != LS_DESTINATION_FILE) {
 		LS_LOG_PRINTF(warn, "Logger '%s' has a filename option, but its destination is not a file", l->name);
 		return FALSE;
 	}
 
-	if (state->did_set_append && l->dest_type != LS_DESTINATION_FILE) {
+	if ((seen & OPT_SEEN_APPEND) && l->sinks[0].dest_type != LS_DESTINATION_FILE) {
 		LS_LOG_PRINTF(warn, "Logger '%s' has an append option, but its destination is not a file", l->name);
 		return FALSE;
 	}
 
-	if (l->dest_type == LS_DESTINATION_FILE && !state->did_set_filename) {
+	if ((seen & OPT_SEEN_BUFFER) && l->sinks[0].dest_type != LS_DESTINATION_FILE) {
+		LS_LOG_PRINTF(warn, "Logger '%s' has a buffer option, but its destination is not a file", l->name);
+		return FALSE;
+	}
+
+	if ((seen & OPT_SEEN_COMPRESS) && l->sinks[0].dest_type != LS_DESTINATION_FILE) {
+		LS_LOG_PRINTF(warn, "Logger '%s' has a compress option, but its destination is not a file", l->name);
+		return FALSE;
+	}
+
+	if ((seen & OPT_SEEN_INDEX) && l->sinks[0].dest_type != LS_DESTINATION_FILE) {
+		LS_LOG_PRINTF(warn, "Logger '%s' has an index option, but its destination is not a file", l->name);
+		return FALSE;
+	}
+
+	if (l->sinks[0].dest_type == LS_DESTINATION_FILE && !(seen & OPT_SEEN_FILENAME)) {
 		LS_LOG_PRINTF(warn, "Logger '%s' has no filename option, but its destination is a file", l->name);
 		return FALSE;
 	}
 
+	if (!are_sinks_valid(l)) {
+		return FALSE;
+	}
+
+	if ((seen & OPT_SEEN_BURST) && !(seen & OPT_SEEN_RATE)) {
+		LS_LOG_PRINTF(warn, "Logger '%s' has a burst option, but no rate", l->name);
+		return FALSE;
+	}
+
+	if ((seen & (OPT_SEEN_HIGH_WATERMARK | OPT_SEEN_LOW_WATERMARK)) && !(seen & OPT_SEEN_OVERFLOW)) {
+		LS_LOG_PRINTF(warn, "Logger '%s' has a watermark option, but no overflow policy", l->name);
+		return FALSE;
+	}
+
 	return TRUE;
 }
 
-int parse_config_file(const char* filename, ls_logger_list_t** dest)
+/* A rate without a burst allows one second worth of lines at once. */
+void fill_rate_defaults(int rate, int* burst) {
+	if (rate > 0 && *burst <= 0) {
+		*burst = rate;
+	}
+}
+
+/* The low watermark defaults to half of the high one. */
+int fill_overflow_defaults(ls_logger_t* l, int seen) {
+	if (l->overflow == LS_OVERFLOW_NONE) {
+		return 0;
+	}
+
+	if (!(seen & OPT_SEEN_HIGH_WATERMARK)) {
+		l->high_watermark = LS_DEFAULT_HIGH_WATERMARK;
+	}
+
+	if (!(seen & OPT_SEEN_LOW_WATERMARK)) {
+		l->low_watermark = l->high_watermark / 2;
+	}
+
+	if (l->low_watermark >= l->high_watermark) {
+		LS_LOG_PRINTF(warn, "Logger '%s' has a low_watermark that is not below its high_watermark", l->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+int add_logger(ls_registry_t* reg, const ls_logger_t* logger) {
+	ls_logger_list_t* new = malloc(sizeof(ls_logger_list_t));
+	if (!new) {
+		LS_LOG_PUTS(warn, "Failed to allocate memory");
+		return ENOMEM;
+	}
+
+	new->logger = *logger;
+	memset(&new->state, 0, sizeof(ls_logger_state_t));
+	new->spec = NULL;
+
+	if (registry_insert(reg, new) != OK) {
+		free(new);
+		LS_LOG_PUTS(warn, "Failed to grow the logger registry");
+		return ENOMEM;
+	}
+
+	return OK;
+}
+
+typedef int (*option_handler_t)(const token_t* name, const token_t* value, void* ctx);
+
+typedef struct logger_ctx_t {
+	ls_logger_t* logger;
+	int seen;
+} logger_ctx_t;
+
+int logger_option_handler(const token_t* name, const token_t* value, void* ctx) {
+	logger_ctx_t* lctx = (logger_ctx_t*)ctx;
+	return set_logger_option(name, value, lctx->logger, &lctx->seen);
+}
+
+int settings_option_handler(const token_t* name, const token_t* value, void* ctx) {
+	ls_settings_t* settings = (ls_settings_t*)ctx;
+
+	for (const setting_desc_t* opt = g_settings; opt->name; opt++) {
+		if (token_is(name, opt->name)) {
+			if (parse_uint(value, (int*)((char*)settings + opt->offset)) != 0) {
+				LS_LOG_PRINTF(warn, "Invalid value for setting '%s' (expected a number)", opt->name);
+				return -1;
+			}
+
+			return 0;
+		}
+	}
+
+	LS_LOG_PUTS(warn, "Invalid settings option name");
+	LS_LOG_PUTS(warn, "    expected one of 'max_dynamic_loggers', 'sender_rate',");
+	LS_LOG_PUTS(warn, "                    'sender_burst', 'max_pending_bytes',");
+	LS_LOG_PUTS(warn, "                    'preallocate'");
+
+	return -1;
+}
+
+/* Parses a sequence of `name = value` lines. If in_braces is set, this is the
+ * body of a block, i.e. everything after the opening brace up to and
+ * including the closing one. Otherwise the options run until the end of the
+ * buffer. */
+int parse_options(scanner_t* s, int in_braces, option_handler_t handler, void* ctx) {
+	token_t name, value;
+
+	if (in_braces) {
+		scan_skip_white(s);
+		if (scan_peek(s) != '\n') {
+			scan_error(s, "expected a newline after '{'");
+			return -1;
+		}
+	}
+
+	while (TRUE) {
+		scan_skip_white_and_newlines(s);
+
+		int ch = scan_peek(s);
+		if (ch == '}' && in_braces) {
+			s->pos++;
+			return 0;
+		} else if (ch == -1) {
+			if (!in_braces) {
+				return 0;
+			}
+
+			scan_error(s, "unexpected end of file inside block");
+			return -1;
+		}
+
+		scan_word(s, is_allowed_in_config_option_name, &name);
+		if (name.len == 0) {
+			scan_error(s, "expected an option name");
+			return -1;
+		}
+
+		scan_skip_white(s);
+		if (scan_peek(s) != '=') {
+			scan_error(s, "expected '=' after option name");
+			return -1;
+		}
+		s->pos++;
+
+		int line_no = s->line_no;
+		scan_rest_of_line(s, &value);
+		if (handler(&name, &value, ctx) != 0) {
+			LS_LOG_PRINTF(warn, "Bad option on line %d", line_no);
+			return -1;
+		}
+	}
+}
+
+/* Reads `<name> {` after a block keyword. */
+int parse_block_header(scanner_t* s, token_t* name) {
+	scan_skip_white(s);
+	scan_word(s, is_allowed_in_logger_name, name);
+	if (name->len == 0 || name->len > LS_MAX_LOGGER_NAME_LEN - 1) {
+		scan_error(s, "expected a name");
+		return -1;
+	}
+
+	scan_skip_white_and_newlines(s);
+	if (scan_peek(s) != '{') {
+		scan_error(s, "expected '{'");
+		return -1;
+	}
+	s->pos++;
+
+	return 0;
+}
+
+/* Parses a `logger` or `template` block into the given registry. Both have
+ * the same options; templates are just never opened directly. */
+int parse_logger(scanner_t* s, ls_registry_t* reg) {
+	token_t tok;
+	ls_logger_t logger;
+	logger_ctx_t ctx;
+
+	if (parse_block_header(s, &tok) != 0) {
+		return EINVAL;
+	}
+
+	memset(&logger, 0, sizeof(logger));
+	memcpy(logger.name, tok.start, tok.len);
+	logger.name[tok.len] = '\0';
+	logger.nsinks = 1;
+
+	ctx.logger = &logger;
+	ctx.seen = 0;
+	if (parse_options(s, TRUE, logger_option_handler, &ctx) != 0 ||
+			!is_logger_valid(&logger, ctx.seen, reg) ||
+			fill_overflow_defaults(&logger, ctx.seen) != 0) {
+		return EINVAL;
+	}
+	fill_rate_defaults(logger.rate, &logger.burst);
+	fill_sink_defaults(&logger);
+
+	return add_logger(reg, &logger);
+}
+
+int parse_settings(scanner_t* s, ls_settings_t* settings) {
+	scan_skip_white_and_newlines(s);
+	if (scan_peek(s) != '{') {
+		scan_error(s, "expected '{'");
+		return EINVAL;
+	}
+	s->pos++;
+
+	if (parse_options(s, TRUE, settings_option_handler, settings) != 0) {
+		return EINVAL;
+	}
+	fill_rate_defaults(settings->sender_rate, &settings->sender_burst);
+
+	return OK;
+}
+
+/* Reads the whole file into a single heap buffer. The file size is used as a
+ * hint, but the file is read until EOF regardless. */
+char* read_whole_file(int fd, int* size) {
+	struct stat st;
+	int cap = READ_CHUNK_SIZE;
+	int len = 0;
+
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		cap = (int)st.st_size + 1;
+	}
+
+	char* buf = malloc(cap);
+	if (!buf) {
+		return NULL;
+	}
+
+	while (TRUE) {
+		if (len == cap) {
+			char* bigger = realloc(buf, cap * 2);
+			if (!bigger) {
+				free(buf);
+				return NULL;
+			}
+			buf = bigger;
+			cap *= 2;
+		}
+
+		ssize_t nread = read(fd, buf + len, cap - len);
+		if (nread < 0) {
+			free(buf);
+			return NULL;
+		} else if (nread == 0) {
+			break;
+		}
+
+		len += (int)nread;
+	}
+
+	*size = len;
+	return buf;
+}
+
+void scanner_init(scanner_t* s, const char* buf, int size) {
+	s->pos = buf;
+	s->end = buf + size;
+	s->line_start = buf;
+	s->line_no = 1;
+}
+
+int parse_config_buffer(const char* buf, int size, ls_config_t* dest) {
+	scanner_t s;
+	token_t keyword;
+	int ret;
+
+	scanner_init(&s, buf, size);
+	while (TRUE) {
+		scan_skip_white_and_newlines(&s);
+		if (scan_peek(&s) == -1) {
+			break;
+		}
+
+		scan_word(&s, is_allowed_in_logger_name, &keyword);
+		if (token_is(&keyword, "logger")) {
+			ret = parse_logger(&s, &dest->loggers);
+		} else if (token_is(&keyword, "template")) {
+			ret = parse_logger(&s, &dest->templates);
+		} else if (token_is(&keyword, "settings")) {
+			ret = parse_settings(&s, &dest->settings);
+		} else {
+			scan_error(&s, "expected 'logger', 'template' or 'settings'");
+			ret = EINVAL;
+		}
+
+		if (ret != OK) {
+			return ret;
+		}
+	}
+
+	return OK;
+}
+
+void config_init(ls_config_t* config) {
+	registry_init(&config->loggers);
+	registry_init(&config->templates);
+	memset(&config->settings, 0, sizeof(ls_settings_t));
+	config->settings.max_dynamic_loggers = LS_DEFAULT_MAX_DYNAMIC_LOGGERS;
+	config->settings.max_pending_bytes = LS_DEFAULT_MAX_PENDING_BYTES;
+}
+
+void config_free(ls_config_t* config) {
+	registry_free(&config->loggers);
+	registry_free(&config->templates);
+	config_init(config);
+}
+
+int parse_config_file(const char* filename, ls_config_t* dest)
 {
-	ls_logger_list_t *l, *nxt;
 	int ret = OK;
+	int size;
 
 	int fd = open(filename, O_RDONLY);
 	LS_LOG_PRINTF(info, "Parsing config file '%s'", filename);
 
 	if (fd < 0) {
 		LS_LOG_PRINTF(warn, "Failed opening file '%s': %d", filename, fd);
-		ret = fd;
-		goto failure;
-	}
-	LS_LOG_PRINTF(debug, "Successfully opened '%s'", filename);
-
-	bufio_t* bufio = bufio_init(fd);
-	if (!bufio) {
-		ret = ENOMEM;
-		LS_LOG_PUTS(warn, "Failed to allocate bufio");
-		goto close_fd;
-	}
-	LS_LOG_PUTS(debug, "Successfully allocated bufio");
-
-	parser_state_t* state = parse_init();
-	if (!state) {
-		ret = ENOMEM;
-		LS_LOG_PUTS(warn, "Failed to init parser state");
-		goto dealloc_bufio;
-	}
-	LS_LOG_PUTS(debug, "Successfully initialized parser state");
-
-	ls_logger_list_t *head = NULL, *last = NULL;
-	int nloggers = 0;
-
-	parser_result_t res;
-	int c = bufio_next_char(bufio);
-	while (c != BUFIO_EOF && c != BUFIO_ERR) {
-		res = parse_advance(state, (char)c, '\0');
-		switch (res.kind) {
-			case PARSE_ERROR:
-				LS_LOG_PRINTF(warn, "Parse error on line %d char %d.\n", res.error_line_no, res.error_char_no);
-				ret = EINVAL;
-				goto dealloc_bufio;
-				break;
-
-			case PARSE_GOT_LOGGER:
-				LS_LOG_PUTS(debug, "Got a logger");
-				if (!is_logger_valid(state, head)) {
-					ret = EINVAL;
-					goto dealloc_loggers;
-				}
-
-				ls_logger_list_t* new = malloc(sizeof(ls_logger_list_t));
-				if (!new) {
-					ret = ENOMEM;
-					LS_LOG_PUTS(warn, "Failed to allocate memory");
-					goto dealloc_loggers;
-				}
-
-				new->logger = state->current_logger;
-				memset(&new->state, 0, sizeof(ls_logger_state_t));
-				if (!head) {
-					head = new;
-				}
-				if (last) {
-					last->tail = new;
-				}
-				last = new;
-				nloggers++;
-
-				break;
-
-			case PARSE_OK:
-				break;
-		}
-		c = bufio_next_char(bufio);
+		return fd;
 	}
 
-	if (c == BUFIO_ERR) {
+	char* buf = read_whole_file(fd, &size);
+	close(fd);
+
+	if (!buf) {
 		LS_LOG_PUTS(warn, "Error reading config file");
-		ret = EIO;
-		goto dealloc_loggers;
+		return EIO;
 	}
 
-	LS_LOG_PRINTF(info, "Successfully parsed config file and registered %d loggers", nloggers);
+	ls_config_t config;
+	config_init(&config);
 
-	*dest = head;
-	goto dealloc_bufio;
+	ret = parse_config_buffer(buf, size, &config);
+	free(buf);
 
-dealloc_loggers:
-	for (l = head; l; l = nxt) {
-		nxt = l->tail;
-		free(l);
+	if (ret != OK) {
+		config_free(&config);
+		return ret;
 	}
 
-dealloc_bufio:
-	bufio_free(bufio);
+	LS_LOG_PRINTF(info, "Successfully parsed config file and registered %d loggers, %d templates", config.loggers.count, config.templates.count);
 
-close_fd:
-	close(fd);
+	*dest = config;
+	return OK;
+}
+
+/* Writes `pattern` to `out`, replacing every `%name` with `name`. */
+int expand_name_pattern(const char* pattern, const char* name, char* out, int out_len) {
+	char* po = out;
+	char* pend = out + out_len - 1;
+	int name_len = (int)strlen(name);
+
+	while (*pattern) {
+		if (strncmp(pattern, "%name", 5) == 0) {
+			if (pend - po < name_len) {
+				return -1;
+			}
+
+			memcpy(po, name, name_len);
+			po += name_len;
+			pattern += 5;
+		} else {
+			if (po >= pend) {
+				return -1;
+			}
+
+			*po++ = *pattern++;
+		}
+	}
+	*po = '\0';
+
+	return 0;
+}
+
+int instantiate_template(const ls_logger_t* tmpl, const char* name, const char* overrides, int overrides_len, ls_logger_t* dest) {
+	scanner_t s;
+	logger_ctx_t ctx;
+	ls_logger_t logger = *tmpl;
+
+	strncpy(logger.name, name, LS_MAX_LOGGER_NAME_LEN);
+	logger.name[LS_MAX_LOGGER_NAME_LEN - 1] = '\0';
+
+	ctx.logger = &logger;
+	ctx.seen = 0;
+	scanner_init(&s, overrides, overrides_len);
+	if (parse_options(&s, FALSE, logger_option_handler, &ctx) != 0) {
+		return EINVAL;
+	}
+
+	for (int i = 0; i < logger.nsinks; i++) {
+		ls_sink_t* sink = &logger.sinks[i];
+
+		if (sink->dest_type == LS_DESTINATION_FILE) {
+			char filename[LS_MAX_LOGGER_LOGFILE_PATH_LEN];
+			if (sink->dest_filename[0] == '\0') {
+				LS_LOG_PRINTF(warn, "Logger '%s' has no filename option, but its destination is a file", name);
+				return EINVAL;
+			}
+
+			if (expand_name_pattern(sink->dest_filename, name, filename, LS_MAX_LOGGER_LOGFILE_PATH_LEN) != 0) {
+				LS_LOG_PRINTF(warn, "Expanded filename for logger '%s' is too long", name);
+				return EINVAL;
+			}
+
+			memcpy(sink->dest_filename, filename, LS_MAX_LOGGER_LOGFILE_PATH_LEN);
+		} else {
+			sink->dest_filename[0] = '\0';
+			sink->append = FALSE;
+			sink->buffer = 0;
+			sink->compress = LS_COMPRESS_NONE;
+			sink->index = 0;
+		}
+
+		if (sink->dest_type != LS_DESTINATION_SYSLOG) {
+			sink->facility = 0;
+		}
+	}
+
+	if (!are_sinks_valid(&logger)) {
+		return EINVAL;
+	}
+	fill_sink_defaults(&logger);
+
+	if (ctx.seen & OPT_SEEN_RATE) {
+		logger.burst = (ctx.seen & OPT_SEEN_BURST) ? logger.burst : 0;
+	}
+	fill_rate_defaults(logger.rate, &logger.burst);
+
+	/* Watermarks that the template already had count as set, except that a
+	 * new high watermark without a low one moves the low one along. */
+	int seen = ctx.seen;
+	if (tmpl->overflow != LS_OVERFLOW_NONE) {
+		seen |= OPT_SEEN_HIGH_WATERMARK;
+		if (!(ctx.seen & OPT_SEEN_HIGH_WATERMARK)) {
+			seen |= OPT_SEEN_LOW_WATERMARK;
+		}
+	}
+	if (fill_overflow_defaults(&logger, seen) != 0) {
+		return EINVAL;
+	}
 
-failure:
-	return ret;
+	*dest = logger;
+	return OK;
 }
@@ -1,4 +1,8 @@
 #pragma once
 #include "proto.h"
 
-int parse_config_file(const char* filename, ls_logger_list_t** dst);
+void config_init(ls_config_t* config);
+void config_free(ls_config_t* config);
+int parse_config_file(const char* filename, ls_config_t* dst);
+int instantiate_template(const ls_logger_t* tmpl, const char* name, const char* overrides, int overrides_len, ls_logger_t* dest);
+int add_logger(ls_registry_t* reg, const ls_logger_t* logger);
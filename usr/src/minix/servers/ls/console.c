@@ -0,0 +1,78 @@
+#include <string.h>
+#include <minix/syslib.h>
+#include "proto.h"
+#include "mini-printf.h"
+
+/* Console output for stdout and stderr destinations. Going through printf()
+ * hands every character to kputc(), which only reaches the kernel in
+ * DIAG_BUFSIZE pieces anyway. Instead, whole lines are collected into one
+ * buffer per stream and each buffer is passed to the kernel with a single
+ * diag call on the next drain timer, or when it fills up. The two
+ * streams never share a buffer, and stderr lines are tagged differently, so
+ * they can be told apart in the kernel log. */
+
+typedef struct ls_console_t {
+	const char* tag;
+	char buf[DIAG_BUFSIZE];
+	int len;
+} ls_console_t;
+
+ls_console_t g_console_stdout = { "[L] ", { 0 }, 0 };
+ls_console_t g_console_stderr = { "[L!] ", { 0 }, 0 };
+
+void console_flush_stream(ls_console_t* c) {
+	int ret;
+
+	if (c->len == 0) {
+		return;
+	}
+
+	if ((ret = sys_diagctl_diag(c->buf, c->len)) != OK) {
+		LS_LOG_PRINTF(warn, "Failed writing %d bytes to the console: %d", c->len, ret);
+	}
+	c->len = 0;
+}
+
+void console_append(ls_console_t* c, const char* data, int len) {
+	while (len > 0) {
+		int n = DIAG_BUFSIZE - c->len;
+		if (n == 0) {
+			console_flush_stream(c);
+			continue;
+		}
+
+		if (n > len) {
+			n = len;
+		}
+
+		memcpy(c->buf + c->len, data, n);
+		c->len += n;
+		data += n;
+		len -= n;
+	}
+}
+
+int console_write(ls_log_destination_t dest, const char* line, int len) {
+	ls_console_t* c = dest == LS_DESTINATION_STDERR ? &g_console_stderr : &g_console_stdout;
+	int tag_len = strlen(c->tag);
+
+	/* Keep lines in one piece where they fit. */
+	if (c->len + tag_len + len > DIAG_BUFSIZE) {
+		console_flush_stream(c);
+	}
+
+	console_append(c, c->tag, tag_len);
+	console_append(c, line, len);
+
+	return OK;
+}
+
+int console_pending() {
+	return g_console_stderr.len > 0 || g_console_stdout.len > 0;
+}
+
+/* Errors go out first. */
+void console_flush() {
+	console_flush_stream(&g_console_stderr);
+	console_flush_stream(&g_console_stdout);
+}
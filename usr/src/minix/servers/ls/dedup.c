@@ -0,0 +1,45 @@
+#include "proto.h"
+#include <string.h>
+#include "mini-printf.h"
+
+/* Folding of consecutive identical lines. Only a hash of the last line that
+ * was actually written is kept, so a repeat costs one pass over the message
+ * and a compare, instead of formatting and writing it. */
+
+u64_t hash_message(ls_severity_level_t severity, const char* msg, int msg_len) {
+	/* FNV-1a, 64-bit */
+	u64_t h = 14695981039346656037ULL ^ (u64_t)severity;
+	for (int i = 0; i < msg_len; i++) {
+		h ^= (unsigned char)msg[i];
+		h *= 1099511628211ULL;
+	}
+
+	return h;
+}
+
+int dedup_is_repeat(const ls_logger_list_t* l, u64_t hash, int msg_len) {
+	return l->state.dedup_valid && l->state.dedup_hash == hash && l->state.dedup_len == msg_len;
+}
+
+void dedup_remember(ls_logger_list_t* l, u64_t hash, int msg_len, ls_severity_level_t severity) {
+	l->state.dedup_valid = TRUE;
+	l->state.dedup_hash = hash;
+	l->state.dedup_len = msg_len;
+	l->state.dedup_severity = severity;
+}
+
+/* Writes the "last message repeated N times" record for repeats folded since
+ * the last line was written. */
+int dedup_flush(ls_logger_list_t* l, endpoint_t who) {
+	char msg[64];
+
+	if (!l->state.repeats) {
+		return OK;
+	}
+
+	mini_snprintf(msg, sizeof(msg), "last message repeated %u times", l->state.repeats);
+	msg[sizeof(msg) - 1] = '\0';
+	l->state.repeats = 0;
+
+	return emit_line(l, l->state.dedup_severity, msg, strlen(msg), 0, who);
+}
@@ -0,0 +1,563 @@
+#include <sys/errno.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <minix/sysutil.h>
+#include "proto.h"
+#include "lz.h"
+#include "index.h"
+#include "mini-printf.h"
+
+/* Files written by file sinks. All sinks that write to the same path, of one
+ * logger or of several, share one ls_file_t: one fd, so their lines go through
+ * a single filp in the order they were written out, and one buffer. The
+ * buffer is handed to VFS with one write() when it fills up, on the next tick
+ * of the drain timer, when the queues are drained completely, and when the
+ * file is closed; each file is synced at most once per tick, however many
+ * loggers wrote to it, and when it is closed. Files are looked up by the path
+ * as it is written in the config. Whether a shared file is truncated is up to the sink
+ * that opens it first. The buffer is LS_FILE_BUFSIZE bytes unless a sink asks
+ * for more with its buffer option, in which case it is as large as the largest
+ * one asked for by the sinks sharing the file, so that a busy file is handed to
+ * VFS in fewer and larger writes.
+ *
+ * With the preallocate setting, the space a file grows into is written with
+ * zeros a chunk at a time, ahead of the end of the log, so that the file
+ * system allocates its blocks in bulk rather than on every write that goes
+ * past the end. Such files are written at an offset kept here instead of with
+ * O_APPEND, and cut back to the end of the log when they are closed. Lines are
+ * not told apart from the zeros by their content; instead, while the file is
+ * open, where the log ends is kept in a file next to it, at its path with
+ * LS_END_SUFFIX appended, and written right before each sync of the file,
+ * which takes it to disk along with the lines. It is removed once the file
+ * has been cut back. A file that was not closed, e.g.
+ * because ls crashed, ends in zeros; when it is opened for appending again,
+ * lines are written from the end that was last synced.
+ *
+ * Sinks with compress = lz write their file as blocks of at most
+ * LS_LZ_BLOCK_SIZE bytes of lines, each compressed on its own (see lz.h).
+ * The buffer of such a file is the block being filled, and it only starts a
+ * new block at a line that would not fit. Each block is compressed and
+ * appended once: when it is full, when it has been open for LS_LZ_BLOCK_SECS,
+ * when the queues are drained completely, and when the file is closed. The
+ * file thus always ends with a whole block, and a crash loses at most the
+ * lines of the last LS_LZ_BLOCK_SECS. Whether a shared file is compressed is
+ * up to the sink that opens it first. Compressed files are not
+ * preallocated.
+ *
+ * Sinks with the index option keep an index next to their file (see index.h).
+ * The region being indexed is only added to the index once it is complete, or
+ * when the file is closed. Compressed files are not indexed. */
+
+typedef struct ls_file_t {
+	struct ls_file_t* next;
+	char path[LS_MAX_LOGGER_LOGFILE_PATH_LEN];
+	int fd;
+	int refs;
+	int chunk;
+	off_t end;
+	off_t allocated;
+	int truncated;
+	int dirty;
+	int len;
+	int size;
+	char* buf;
+	ls_compression_t compress;
+	clock_t block_start;
+	int end_fd;
+	int index_fd;
+	int index_every;
+	ls_index_entry_t region;
+	unsigned int writes;
+	unsigned int syncs;
+} ls_file_t;
+
+ls_file_t* g_files;
+char g_zeros[LS_FILE_BUFSIZE];
+char g_lz_block[sizeof(ls_lz_header_t) + LS_LZ_BLOCK_SIZE];
+
+/* Opens the file that keeps where the log ends in a preallocated file, and
+ * returns where it ends: as last recorded, or, if nothing was recorded because
+ * the file was closed properly or never preallocated, the size of the file. */
+off_t file_open_end(ls_file_t* f, const char* path, off_t size) {
+	char end_path[LS_MAX_LOGGER_LOGFILE_PATH_LEN + sizeof(LS_END_SUFFIX)];
+	u64_t end;
+
+	mini_snprintf(end_path, sizeof(end_path), "%s" LS_END_SUFFIX, path);
+	f->end_fd = open(end_path, O_RDWR | O_CREAT);
+	if (f->end_fd < 0) {
+		return -1;
+	}
+
+	if (read(f->end_fd, &end, sizeof(end)) == sizeof(end) && end <= (u64_t) size) {
+		return (off_t) end;
+	}
+
+	return size;
+}
+
+/* Records where the log ends in a preallocated file. It is not synced on its
+ * own: fsync() flushes the whole file system on MINIX, so the sync of the
+ * file that follows makes the record and the lines it covers durable
+ * together. */
+void file_save_end(ls_file_t* f) {
+	u64_t end = f->end;
+
+	f->writes++;
+	if (lseek(f->end_fd, 0, SEEK_SET) < 0 || write(f->end_fd, &end, sizeof(end)) != sizeof(end)) {
+		LS_LOG_PRINTF(warn, "Failed to record where the log ends in file '%s'", f->path);
+	}
+}
+
+/* Closes and removes the file that keeps where the log ends. */
+void file_close_end(ls_file_t* f) {
+	char end_path[LS_MAX_LOGGER_LOGFILE_PATH_LEN + sizeof(LS_END_SUFFIX)];
+
+	close(f->end_fd);
+	f->end_fd = -1;
+	mini_snprintf(end_path, sizeof(end_path), "%s" LS_END_SUFFIX, f->path);
+	unlink(end_path);
+}
+
+/* Finds where the last whole block ends in a compressed file. Whatever comes
+ * after it was cut short, e.g. by a crash, and is cut off. */
+off_t file_find_blocks(int fd) {
+	ls_lz_header_t hdr;
+	off_t size = lseek(fd, 0, SEEK_END);
+	off_t end = 0;
+
+	while (end + (off_t) sizeof(hdr) <= size) {
+		if (lseek(fd, end, SEEK_SET) < 0 || read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+			break;
+		}
+
+		off_t next = end + sizeof(hdr) + hdr.stored_len;
+		if (hdr.magic != LS_LZ_MAGIC || hdr.stored_len > LS_LZ_BLOCK_SIZE || next > size) {
+			break;
+		}
+		end = next;
+	}
+
+	if (end < size) {
+		ftruncate(fd, end);
+	}
+
+	return end;
+}
+
+int file_write_out(ls_file_t* f, const char* data, int len);
+
+/* Grows the buffer of a file that is already open. The file keeps its old
+ * buffer if there is not enough memory for the new one. */
+void file_grow_buffer(ls_file_t* f, int size) {
+	if (f->len > 0) {
+		file_write_out(f, f->buf, f->len);
+		f->len = 0;
+	}
+
+	char* buf = realloc(f->buf, size);
+	if (!buf) {
+		LS_LOG_PRINTF(warn, "Out of memory growing the buffer of file '%s'", f->path);
+		return;
+	}
+
+	f->buf = buf;
+	f->size = size;
+}
+
+ls_file_t* file_open(const ls_sink_t* sink, int truncate) {
+	const char* path = sink->dest_filename;
+	int size = sink->buffer < LS_FILE_BUFSIZE ? LS_FILE_BUFSIZE : sink->buffer;
+	if (sink->compress != LS_COMPRESS_NONE) {
+		size = LS_LZ_BLOCK_SIZE;
+	}
+
+	for (ls_file_t* f = g_files; f; f = f->next) {
+		if (strcmp(f->path, path) == 0) {
+			if (truncate != f->truncated) {
+				LS_LOG_PRINTF(info, "File '%s' is already open, the append setting of this sink does not apply", path);
+			}
+			if (sink->compress != f->compress) {
+				LS_LOG_PRINTF(info, "File '%s' is already open, the compress setting of this sink does not apply", path);
+			}
+			if (sink->index && f->index_fd < 0) {
+				LS_LOG_PRINTF(info, "File '%s' is already open, the index setting of this sink does not apply", path);
+			}
+			if (!f->compress && size > f->size) {
+				file_grow_buffer(f, size);
+			}
+			f->refs++;
+			return f;
+		}
+	}
+
+	ls_file_t* f = malloc(sizeof(ls_file_t));
+	if (!f) {
+		LS_LOG_PRINTF(warn, "Out of memory opening file '%s'", path);
+		return NULL;
+	}
+
+	f->buf = malloc(size);
+	if (!f->buf) {
+		LS_LOG_PRINTF(warn, "Out of memory opening file '%s'", path);
+		free(f);
+		return NULL;
+	}
+	f->size = size;
+
+	f->compress = sink->compress;
+	f->chunk = f->compress ? 0 : g_config.settings.preallocate;
+	if (f->chunk || f->compress) {
+		f->fd = open(path, O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0));
+	} else {
+		f->fd = open(path, O_WRONLY | O_CREAT | (truncate ? O_TRUNC : O_APPEND));
+	}
+	if (f->fd < 0) {
+		free(f->buf);
+		free(f);
+		return NULL;
+	}
+
+	f->end = f->allocated = 0;
+	f->end_fd = -1;
+	if (f->compress) {
+		f->end = truncate ? 0 : file_find_blocks(f->fd);
+		lseek(f->fd, f->end, SEEK_SET);
+	} else if (f->chunk) {
+		/* Devices cannot be preallocated; they are written as they are. */
+		off_t size = lseek(f->fd, 0, SEEK_END);
+		off_t end = size < 0 ? -1 : file_open_end(f, path, size);
+		if (end < 0) {
+			/* Without a record of the end, the file is not preallocated. */
+			if (size >= 0) {
+				LS_LOG_PRINTF(warn, "Failed to keep where the log ends in file '%s', not preallocating it", path);
+			}
+			f->chunk = 0;
+			f->end = size < 0 ? 0 : size;
+		} else {
+			f->allocated = size;
+			f->end = end;
+			lseek(f->fd, f->end, SEEK_SET);
+		}
+	} else {
+		off_t size = lseek(f->fd, 0, SEEK_END);
+		f->end = size < 0 ? 0 : size;
+	}
+
+	f->index_fd = -1;
+	f->index_every = sink->index;
+	f->region.lines = 0;
+	if (f->index_every && !f->compress) {
+		char index_path[LS_MAX_LOGGER_LOGFILE_PATH_LEN + sizeof(LS_INDEX_SUFFIX)];
+		mini_snprintf(index_path, sizeof(index_path), "%s" LS_INDEX_SUFFIX, path);
+		f->index_fd = open(index_path, O_WRONLY | O_CREAT | (truncate ? O_TRUNC : O_APPEND));
+		if (f->index_fd < 0) {
+			LS_LOG_PRINTF(warn, "Failed to open index '%s', file '%s' is not indexed", index_path, path);
+		}
+	}
+
+	strncpy(f->path, path, LS_MAX_LOGGER_LOGFILE_PATH_LEN - 1);
+	f->path[LS_MAX_LOGGER_LOGFILE_PATH_LEN - 1] = '\0';
+	f->refs = 1;
+	f->truncated = truncate;
+	f->dirty = FALSE;
+	f->len = 0;
+	f->writes = f->syncs = 0;
+	f->next = g_files;
+	g_files = f;
+
+	return f;
+}
+
+/* Makes sure the file has space allocated up to at least need bytes. If that
+ * fails, e.g. because the disk is nearly full, the file is written without
+ * preallocation from then on. */
+void file_preallocate(ls_file_t* f, off_t need) {
+	off_t target = f->allocated;
+
+	while (target < need) {
+		target += f->chunk;
+	}
+
+	if (lseek(f->fd, f->allocated, SEEK_SET) < 0) {
+		f->chunk = 0;
+		return;
+	}
+
+	while (f->allocated < target) {
+		int n = target - f->allocated < LS_FILE_BUFSIZE ? (int) (target - f->allocated) : LS_FILE_BUFSIZE;
+		f->writes++;
+		if (write(f->fd, g_zeros, n) != n) {
+			LS_LOG_PRINTF(warn, "Failed to preallocate file '%s', not preallocating it any more", f->path);
+			ftruncate(f->fd, f->end);
+			f->allocated = f->end;
+			f->chunk = 0;
+			break;
+		}
+		f->allocated += n;
+	}
+
+	lseek(f->fd, f->end, SEEK_SET);
+}
+
+int file_write_out(ls_file_t* f, const char* data, int len) {
+	if (f->chunk && f->end + len > f->allocated) {
+		file_preallocate(f, f->end + len);
+	}
+
+	f->writes++;
+	int ret = write(f->fd, data, len);
+	if (ret == -1 || ret < len) {
+		LS_LOG_PRINTF(warn, "Failed writing %d bytes to file '%s'", len, f->path);
+		if (ret > 0) {
+			f->end += ret;
+		}
+		return LS_ERR_EXTERNAL;
+	}
+
+	f->end += len;
+	f->dirty = TRUE;
+	return OK;
+}
+
+/* Adds the region being indexed to the index. */
+void file_index_region(ls_file_t* f) {
+	if (f->region.lines == 0) {
+		return;
+	}
+
+	f->region.length = f->end + f->len - f->region.offset;
+	if (write(f->index_fd, &f->region, sizeof(f->region)) != sizeof(f->region)) {
+		LS_LOG_PRINTF(warn, "Failed writing to the index of file '%s'", f->path);
+	}
+	f->region.lines = 0;
+}
+
+/* Notes a line that is about to be written in the index. A region ends at a
+ * line from a later second than the region's first, or once it has as many
+ * lines as the index option asks for. */
+void file_index_line(ls_file_t* f, ls_severity_level_t severity, u64_t tsc) {
+	if (f->index_fd < 0) {
+		return;
+	}
+
+	u32_t t = clock_epoch_ms(tsc) / 1000;
+	if (f->region.lines >= (u32_t) f->index_every || (f->region.lines > 0 && t > f->region.min_time)) {
+		file_index_region(f);
+	}
+
+	if (f->region.lines == 0) {
+		memset(&f->region, 0, sizeof(f->region));
+		f->region.offset = f->end + f->len;
+		f->region.min_time = t;
+		f->region.max_time = t;
+	}
+
+	if (t < f->region.min_time) {
+		f->region.min_time = t;
+	}
+	if (t > f->region.max_time) {
+		f->region.max_time = t;
+	}
+	f->region.severities |= 1u << severity;
+	f->region.lines++;
+}
+
+/* Compresses the block in the buffer and appends it to the file. A block
+ * that could not be written whole is cut off again, so that the file still
+ * ends with a whole block. */
+int file_write_block(ls_file_t* f) {
+	ls_lz_header_t hdr;
+	char* data = g_lz_block + sizeof(hdr);
+
+	int n = lz_compress(f->buf, f->len, data, f->len - 1);
+	if (n < 0) {
+		memcpy(data, f->buf, f->len);
+		n = f->len;
+	}
+
+	hdr.magic = LS_LZ_MAGIC;
+	hdr.flags = n == f->len ? LS_LZ_STORED : 0;
+	hdr.raw_len = f->len;
+	hdr.stored_len = n;
+	memcpy(g_lz_block, &hdr, sizeof(hdr));
+
+	int total = sizeof(hdr) + n;
+	f->len = 0;
+	f->writes++;
+	if (write(f->fd, g_lz_block, total) != total) {
+		LS_LOG_PRINTF(warn, "Failed writing a block of %d bytes to file '%s'", total, f->path);
+		ftruncate(f->fd, f->end);
+		lseek(f->fd, f->end, SEEK_SET);
+		return LS_ERR_EXTERNAL;
+	}
+
+	f->end += total;
+	f->dirty = TRUE;
+	return OK;
+}
+
+/* Adds a line to the block in the buffer of a compressed file, and starts a
+ * new block if it does not fit. Only lines longer than a whole block are
+ * split across blocks. */
+int file_write_compressed(ls_file_t* f, const char* line, int len) {
+	int ret = OK;
+
+	while (len > 0) {
+		if (f->len > 0 && f->len + len > f->size) {
+			if (file_write_block(f) != OK) {
+				ret = LS_ERR_EXTERNAL;
+			}
+		}
+		if (f->len == 0 && getticks(&f->block_start) != OK) {
+			f->block_start = 0;
+		}
+
+		int n = len < f->size - f->len ? len : f->size - f->len;
+		memcpy(f->buf + f->len, line, n);
+		f->len += n;
+		line += n;
+		len -= n;
+	}
+
+	return ret;
+}
+
+/* Writes out the buffer. */
+int file_flush(ls_file_t* f) {
+	int ret = OK;
+
+	if (f->compress) {
+		if (f->len > 0) {
+			ret = file_write_block(f);
+		}
+	} else if (f->len > 0) {
+		ret = file_write_out(f, f->buf, f->len);
+		f->len = 0;
+	}
+
+	return ret;
+}
+
+/* Syncs the file if anything was written to it since it was last synced. */
+void file_sync(ls_file_t* f) {
+	if (f->dirty) {
+		if (f->end_fd >= 0) {
+			file_save_end(f);
+		}
+		fsync(f->fd);
+		f->syncs++;
+		f->dirty = FALSE;
+	}
+}
+
+int file_write(ls_file_t* f, const char* line, int len) {
+	int ret = OK;
+
+	if (f->compress) {
+		return file_write_compressed(f, line, len);
+	}
+
+	if (f->len + len > f->size) {
+		ret = file_flush(f);
+	}
+
+	if (len > f->size) {
+		int ret_write = file_write_out(f, line, len);
+		return ret == OK ? ret_write : ret;
+	}
+
+	memcpy(f->buf + f->len, line, len);
+	f->len += len;
+
+	return ret;
+}
+
+int file_close(ls_file_t* f) {
+	int ret = OK;
+
+	if (--f->refs > 0) {
+		return OK;
+	}
+
+	ret = file_flush(f);
+	file_sync(f);
+	if (f->index_fd >= 0) {
+		file_index_region(f);
+		close(f->index_fd);
+	}
+	if (f->allocated > f->end && ftruncate(f->fd, f->end) != OK) {
+		LS_LOG_PRINTF(warn, "Failed to cut file '%s' back to the end of the log", f->path);
+	} else if (f->end_fd >= 0) {
+		/* The record of the end is only dropped once the cut is on disk. */
+		fsync(f->fd);
+		file_close_end(f);
+	}
+	if (f->end_fd >= 0) {
+		close(f->end_fd);
+	}
+	if (close(f->fd) != OK) {
+		LS_LOG_PRINTF(warn, "Failed to close file '%s'", f->path);
+		ret = LS_ERR_EXTERNAL;
+	}
+
+	for (ls_file_t** pf = &g_files; *pf; pf = &(*pf)->next) {
+		if (*pf == f) {
+			*pf = f->next;
+			break;
+		}
+	}
+	free(f->buf);
+	free(f);
+
+	return ret;
+}
+
+void files_flush() {
+	for (ls_file_t* f = g_files; f; f = f->next) {
+		file_flush(f);
+	}
+}
+
+/* Called on every tick of the drain timer. Buffers are written out, but the
+ * block of a compressed file is kept open until it is LS_LZ_BLOCK_SECS old,
+ * so that a slow logger does not write many small blocks. */
+void files_tick() {
+	clock_t now;
+
+	if (getticks(&now) != OK) {
+		now = 0;
+	}
+
+	for (ls_file_t* f = g_files; f; f = f->next) {
+		if (!f->compress || now - f->block_start >= (clock_t) sys_hz() * LS_LZ_BLOCK_SECS) {
+			file_flush(f);
+		}
+	}
+}
+
+void files_sync() {
+	for (ls_file_t* f = g_files; f; f = f->next) {
+		file_sync(f);
+	}
+}
+
+/* Returns how many times the file has been written to and synced since it
+ * was opened. */
+void file_counts(const ls_file_t* f, unsigned int* writes, unsigned int* syncs) {
+	*writes = f->writes;
+	*syncs = f->syncs;
+}
+
+/* Returns TRUE if a file has lines in its buffer, or has been written to
+ * since it was last synced. */
+int files_pending() {
+	for (ls_file_t* f = g_files; f; f = f->next) {
+		if (f->len > 0 || f->dirty) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
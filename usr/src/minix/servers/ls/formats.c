@@ -0,0 +1,338 @@
+#include "proto.h"
+#include <minix/endpoint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/errno.h>
+#include "mini-printf.h"
+
+/* Format strings interned for minix_ls_writef. A client registers each format
+ * once and gets back its id; after that it only sends the id and the raw
+ * argument values, and the message is put together here, after the line has
+ * made it past filtering, sampling and rate limiting. Ids stay valid for as
+ * long as ls runs, across config reloads, so the table is never cleared; to
+ * keep one client from filling it for everyone, each client may add at most
+ * LS_MAX_FORMATS_PER_CLIENT formats of its own. Formats that are already
+ * interned are handed out to anyone and count for nobody new.
+ *
+ * Only the conversions that need no floating point are supported: d, i, u, o,
+ * x, X, c, s and p, with the usual flags, a fixed width and precision, and the
+ * hh, h, l, ll and z length modifiers. The client narrows every argument to
+ * the type its length modifier asks for before encoding it, so the modifiers
+ * do not matter here. A NUL that comes out of %c or %s is written as \0, since
+ * everything after a NUL in a message would be taken for kv fields. */
+
+typedef struct ls_format_t {
+	char* text;
+	unsigned int hash;
+	endpoint_t owner;
+} ls_format_t;
+
+typedef struct ls_format_spec_t {
+	int left;
+	int zero;
+	int plus;
+	int space;
+	int alt;
+	int width;
+	int precision;
+	char conversion;
+} ls_format_spec_t;
+
+typedef struct ls_format_out_t {
+	char* p;
+	char* end;
+} ls_format_out_t;
+
+ls_format_t g_formats[LS_MAX_FORMATS];
+int g_nformats;
+
+/* Parses the conversion spec after a '%'. Returns FALSE if it is not one of
+ * the supported ones. */
+int format_parse_spec(const char** pf, ls_format_spec_t* spec) {
+	const char* f = *pf;
+
+	memset(spec, 0, sizeof(*spec));
+	spec->precision = -1;
+
+	for (;; f++) {
+		if (*f == '-') {
+			spec->left = TRUE;
+		} else if (*f == '0') {
+			spec->zero = TRUE;
+		} else if (*f == '+') {
+			spec->plus = TRUE;
+		} else if (*f == ' ') {
+			spec->space = TRUE;
+		} else if (*f == '#') {
+			spec->alt = TRUE;
+		} else {
+			break;
+		}
+	}
+
+	while (*f >= '0' && *f <= '9' && spec->width < LS_MAX_MESSAGE_LEN) {
+		spec->width = spec->width * 10 + (*f++ - '0');
+	}
+
+	if (*f == '.') {
+		f++;
+		spec->precision = 0;
+		while (*f >= '0' && *f <= '9' && spec->precision < LS_MAX_MESSAGE_LEN) {
+			spec->precision = spec->precision * 10 + (*f++ - '0');
+		}
+	}
+
+	if (*f == 'h' || *f == 'l') {
+		f += f[1] == f[0] ? 2 : 1;
+	} else if (*f == 'z') {
+		f++;
+	}
+
+	if (!*f || !strchr("diuoxXcsp%", *f)) {
+		return FALSE;
+	}
+
+	spec->conversion = *f++;
+	*pf = f;
+
+	return TRUE;
+}
+
+/* Returns the number of arguments the format takes, or -1 if it cannot be
+ * rendered here. */
+int format_count_args(const char* text) {
+	ls_format_spec_t spec;
+	int nargs = 0;
+
+	while (*text) {
+		if (*text++ != '%') {
+			continue;
+		}
+
+		if (!format_parse_spec(&text, &spec)) {
+			return -1;
+		}
+
+		if (spec.conversion != '%') {
+			nargs++;
+		}
+	}
+
+	return nargs;
+}
+
+/* Interns a format for a client, or for NONE when formats are restored after
+ * a restart. */
+int format_register(const char* text, endpoint_t owner) {
+	unsigned int hash = hash_name(text);
+	int owned = 0;
+
+	for (int i = 0; i < g_nformats; i++) {
+		if (g_formats[i].hash == hash && strcmp(g_formats[i].text, text) == 0) {
+			return i + 1;
+		}
+		if (owner != NONE && g_formats[i].owner == owner) {
+			owned++;
+		}
+	}
+
+	int nargs = format_count_args(text);
+	if (nargs < 0 || nargs > LS_MAX_FORMAT_ARGS) {
+		LS_LOG_PRINTF(warn, "Refusing to intern unsupported format '%s'", text);
+		return EINVAL;
+	}
+
+	if (g_nformats == LS_MAX_FORMATS) {
+		LS_LOG_PRINTF(warn, "Cannot intern more than %d formats", LS_MAX_FORMATS);
+		return LS_ERR_LIMIT_REACHED;
+	}
+
+	if (owned >= LS_MAX_FORMATS_PER_CLIENT) {
+		LS_LOG_PRINTF(warn, "Pid %d already has %d formats interned, refusing more", owner, owned);
+		return LS_ERR_LIMIT_REACHED;
+	}
+
+	char* copy = strdup(text);
+	if (!copy) {
+		return ENOMEM;
+	}
+
+	g_formats[g_nformats].text = copy;
+	g_formats[g_nformats].hash = hash;
+	g_formats[g_nformats].owner = owner;
+
+	return ++g_nformats;
+}
+
+int format_count() {
+	return g_nformats;
+}
+
+const char* format_text(int id) {
+	if (id < 1 || id > g_nformats) {
+		return NULL;
+	}
+
+	return g_formats[id - 1].text;
+}
+
+void format_putc(ls_format_out_t* out, char c) {
+	if (out->p < out->end) {
+		*out->p++ = c;
+	}
+}
+
+void format_pad(ls_format_out_t* out, char c, int n) {
+	while (n-- > 0) {
+		format_putc(out, c);
+	}
+}
+
+void format_number(ls_format_out_t* out, const ls_format_spec_t* spec, u64_t v, int negative) {
+	const char* digit_chars = spec->conversion == 'X' ? "0123456789ABCDEF" : "0123456789abcdef";
+	char digits[24];
+	char prefix[3];
+	int ndigits = 0;
+	int nprefix = 0;
+	int base = 10;
+
+	if (spec->conversion == 'o') {
+		base = 8;
+	} else if (spec->conversion == 'x' || spec->conversion == 'X' || spec->conversion == 'p') {
+		base = 16;
+	}
+
+	if (v != 0 || spec->precision != 0) {
+		do {
+			digits[ndigits++] = digit_chars[v % base];
+			v /= base;
+		} while (v);
+	}
+
+	if (negative) {
+		prefix[nprefix++] = '-';
+	} else if ((spec->conversion == 'd' || spec->conversion == 'i') && spec->plus) {
+		prefix[nprefix++] = '+';
+	} else if ((spec->conversion == 'd' || spec->conversion == 'i') && spec->space) {
+		prefix[nprefix++] = ' ';
+	}
+
+	if (spec->conversion == 'p' || (spec->alt && base == 16 && ndigits > 0 && digits[ndigits - 1] != '0')) {
+		prefix[nprefix++] = '0';
+		prefix[nprefix++] = spec->conversion == 'X' ? 'X' : 'x';
+	} else if (spec->alt && base == 8 && (ndigits == 0 || digits[ndigits - 1] != '0') && spec->precision <= ndigits) {
+		digits[ndigits++] = '0';
+	}
+
+	int zeros = spec->precision > ndigits ? spec->precision - ndigits : 0;
+	int pad = spec->width - nprefix - zeros - ndigits;
+
+	if (spec->zero && !spec->left && spec->precision < 0 && pad > 0) {
+		zeros += pad;
+		pad = 0;
+	}
+
+	if (!spec->left) {
+		format_pad(out, ' ', pad);
+	}
+	for (int i = 0; i < nprefix; i++) {
+		format_putc(out, prefix[i]);
+	}
+	format_pad(out, '0', zeros);
+	while (ndigits > 0) {
+		format_putc(out, digits[--ndigits]);
+	}
+	if (spec->left) {
+		format_pad(out, ' ', pad);
+	}
+}
+
+void format_bytes(ls_format_out_t* out, const ls_format_spec_t* spec, const char* s, int len) {
+	if (spec->precision >= 0 && len > spec->precision) {
+		len = spec->precision;
+	}
+
+	int width = len;
+	for (int i = 0; i < len; i++) {
+		width += s[i] == '\0';
+	}
+
+	if (!spec->left) {
+		format_pad(out, ' ', spec->width - width);
+	}
+	for (int i = 0; i < len; i++) {
+		if (s[i] == '\0') {
+			format_putc(out, '\\');
+			format_putc(out, '0');
+		} else {
+			format_putc(out, s[i]);
+		}
+	}
+	if (spec->left) {
+		format_pad(out, ' ', spec->width - width);
+	}
+}
+
+/* Puts the message of a minix_ls_writef line together from the format and the
+ * encoded arguments. Returns its length, or an error if the format is unknown
+ * or the arguments do not match it. */
+int format_render(int id, const char* args, int args_len, char* buffer, int buffer_len) {
+	const unsigned char* p = (const unsigned char*) args;
+	const unsigned char* end = p + args_len;
+	ls_format_out_t out = { buffer, buffer + buffer_len };
+	ls_format_spec_t spec;
+
+	if (id < 1 || id > g_nformats) {
+		LS_LOG_PRINTF(warn, "Unknown format id %d", id);
+		return LS_ERR_NO_SUCH_FORMAT;
+	}
+
+	const char* f = g_formats[id - 1].text;
+	while (*f) {
+		if (*f != '%') {
+			format_putc(&out, *f++);
+			continue;
+		}
+
+		f++;
+		format_parse_spec(&f, &spec);
+		if (spec.conversion == '%') {
+			format_putc(&out, '%');
+			continue;
+		}
+
+		u64_t v;
+		if (!get_varint(&p, end, &v)) {
+			return EINVAL;
+		}
+
+		switch (spec.conversion) {
+			case 'd':
+			case 'i': {
+				int64_t sv = unzigzag(v);
+				format_number(&out, &spec, sv < 0 ? -(u64_t)sv : (u64_t)sv, sv < 0);
+				break;
+			}
+
+			case 'c': {
+				char c = (char) v;
+				format_bytes(&out, &spec, &c, 1);
+				break;
+			}
+
+			case 's':
+				if ((u64_t)(end - p) < v) {
+					return EINVAL;
+				}
+				format_bytes(&out, &spec, (const char*) p, (int) v);
+				p += v;
+				break;
+
+			default:
+				format_number(&out, &spec, v, FALSE);
+				break;
+		}
+	}
+
+	return out.p - buffer;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Layout of the index that sinks with the index option keep next to their
+ * file, at the file's path with LS_INDEX_SUFFIX appended; shared with lsgrep.
+ * The index is a sequence of entries, each describing a region of the file: a
+ * run of lines that were written within the same second, cut after the
+ * number of lines given to the option. The region's times and severities are
+ * those of its lines, so a reader can tell from the index alone which regions
+ * can hold the lines it is after, and seek straight to them. Lines after the
+ * last entry belong to a region that is still being filled. */
+
+#define LS_INDEX_SUFFIX						".idx"
+
+typedef struct ls_index_entry_t {
+	uint64_t offset;                /* Where the region starts in the file. */
+	uint32_t length;                /* Its length in bytes. */
+	uint32_t lines;                 /* Number of lines in it. */
+	uint32_t min_time;              /* Earliest and latest line, in seconds */
+	uint32_t max_time;              /* since the epoch. */
+	uint32_t severities;            /* Bit n is set if a line has severity n. */
+	uint32_t unused;
+} ls_index_entry_t;
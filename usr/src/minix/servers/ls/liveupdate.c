@@ -0,0 +1,304 @@
+#include "inc.h"
+#include "mini-printf.h"
+
+/* State that has to survive a live update or a restart of ls by RS. Clients
+ * hold handles, own loggers and have formats interned, and none of them
+ * should notice ls going away. Everything needed to rebuild that is kept in
+ * DS: the config generation, the loggers made by LS_CREATE_LOGGER and what
+ * they were made from, which loggers are open and by whom, severity overrides,
+ * line numbers and counters, and the interned formats.
+ *
+ * Publishing the state copies all of it, so a request that changes it only
+ * marks it as changed, and it is published on the drain timer, at most once
+ * every LS_STATE_PUBLISH_SECS however many requests changed it; creating many
+ * loggers in a row thus does not copy the whole table for each of them. After
+ * a crash, the state is as it was when it was last published, up to that long
+ * before. Before a live update, everything that is still queued is written
+ * out and the state is published once more. The config file is
+ * parsed again on restore. If a logger ends up with another id than it had,
+ * the config has changed, and handles given out before are refused, which
+ * makes clients fall back to writing by name. */
+
+#define LS_STATE_KEY          "ls.state"
+#define LS_STATE_LEN_KEY      "ls.state.len"
+#define LS_STATE_VERSION      1
+
+int g_state_changed;
+clock_t g_state_published;
+
+typedef struct ls_saved_header_t {
+	int version;
+	int generation;
+	int nloggers;
+	int nformats;
+} ls_saved_header_t;
+
+/* Followed by the spec of a logger made from a template, if there is one. */
+typedef struct ls_saved_logger_t {
+	char name[LS_MAX_LOGGER_NAME_LEN];
+	int id;
+	int is_open;
+	endpoint_t opened_by;
+	ls_severity_level_t severity;
+	unsigned int seq;
+	minix_ls_stats_t stats;
+	int template_len;
+	int overrides_len;
+} ls_saved_logger_t;
+
+int lu_state_len() {
+	int len = sizeof(ls_saved_header_t);
+
+	for (ls_logger_list_t* l = g_config.loggers.head; l; l = l->tail) {
+		len += sizeof(ls_saved_logger_t);
+		if (l->spec) {
+			len += l->template_len + l->overrides_len;
+		}
+	}
+
+	for (int id = 1; id <= format_count(); id++) {
+		len += sizeof(int) + strlen(format_text(id));
+	}
+
+	return len;
+}
+
+int lu_publish_state() {
+	ls_saved_header_t hdr;
+	int ret;
+
+	if (!g_is_initialized) {
+		g_state_changed = FALSE;
+		return OK;
+	}
+
+	int len = lu_state_len();
+	char* buf = malloc(len);
+	if (!buf) {
+		LS_LOG_PUTS(warn, "Out of memory saving state");
+		return ENOMEM;
+	}
+
+	hdr.version = LS_STATE_VERSION;
+	hdr.generation = g_config_generation;
+	hdr.nloggers = g_config.loggers.count;
+	hdr.nformats = format_count();
+	memcpy(buf, &hdr, sizeof(hdr));
+	char* p = buf + sizeof(hdr);
+
+	for (ls_logger_list_t* l = g_config.loggers.head; l; l = l->tail) {
+		ls_saved_logger_t saved;
+
+		memset(&saved, 0, sizeof(saved));
+		strncpy(saved.name, l->logger.name, LS_MAX_LOGGER_NAME_LEN - 1);
+		saved.id = l->id;
+		saved.is_open = l->state.is_open;
+		saved.opened_by = l->state.opened_by;
+		saved.severity = l->state.severity;
+		saved.seq = l->state.seq;
+		if (l->state.is_open) {
+			count_sinks(l);
+		}
+		saved.stats = l->state.stats;
+		if (l->spec) {
+			saved.template_len = l->template_len;
+			saved.overrides_len = l->overrides_len;
+		}
+
+		memcpy(p, &saved, sizeof(saved));
+		p += sizeof(saved);
+		if (l->spec) {
+			memcpy(p, l->spec, l->template_len + l->overrides_len);
+			p += l->template_len + l->overrides_len;
+		}
+	}
+
+	for (int id = 1; id <= hdr.nformats; id++) {
+		const char* text = format_text(id);
+		int text_len = strlen(text);
+
+		memcpy(p, &text_len, sizeof(int));
+		memcpy(p + sizeof(int), text, text_len);
+		p += sizeof(int) + text_len;
+	}
+
+	if ((ret = ds_publish_mem(LS_STATE_KEY, buf, len, DSF_OVERWRITE)) != OK ||
+			(ret = ds_publish_u32(LS_STATE_LEN_KEY, len, DSF_OVERWRITE)) != OK) {
+		LS_LOG_PRINTF(warn, "Failed to publish state: %d", ret);
+	} else {
+		g_state_changed = FALSE;
+	}
+
+	free(buf);
+	return ret;
+}
+
+/* Called after every request that changes the state. */
+void lu_state_changed() {
+	g_state_changed = TRUE;
+}
+
+/* Returns TRUE if the state has changed since it was last published. */
+int lu_state_pending() {
+	return g_state_changed;
+}
+
+/* Called on every tick of the drain timer. */
+void lu_state_alarm() {
+	clock_t now;
+
+	if (!g_state_changed || getticks(&now) != OK ||
+			now - g_state_published < (clock_t) sys_hz() * LS_STATE_PUBLISH_SECS) {
+		return;
+	}
+
+	g_state_published = now;
+	lu_publish_state();
+}
+
+/* Restores one logger. Returns FALSE if it no longer has the id it had. */
+int lu_restore_logger(const ls_saved_logger_t* saved, const char* spec) {
+	ls_logger_list_t* l = find_logger(saved->name);
+
+	if (!l && spec) {
+		create_logger(saved->name, spec, saved->template_len, saved->overrides_len);
+		l = find_logger(saved->name);
+	}
+
+	if (!l) {
+		LS_LOG_PRINTF(warn, "Logger '%s' is gone after restart", saved->name);
+		return TRUE;
+	}
+
+	l->state.severity = saved->severity;
+	l->state.seq = saved->seq;
+	l->state.stats = saved->stats;
+
+	if (saved->is_open) {
+		if (open_sinks(l, TRUE) == OK) {
+			bucket_init(&l->state.bucket, l->logger.rate, l->logger.burst);
+			l->state.is_open = TRUE;
+			l->state.opened_by = saved->opened_by;
+		} else {
+			LS_LOG_PRINTF(warn, "Could not reopen logger '%s' after restart", saved->name);
+		}
+	}
+
+	return l->id == saved->id;
+}
+
+int lu_restore_state() {
+	ls_saved_header_t hdr;
+	u32_t len32;
+	int ret;
+
+	if ((ret = ds_retrieve_u32(LS_STATE_LEN_KEY, &len32)) != OK) {
+		LS_LOG_PUTS(info, "No saved state, starting afresh");
+		return OK;
+	}
+
+	size_t len = len32;
+	char* buf = malloc(len);
+	if (!buf) {
+		return ENOMEM;
+	}
+
+	if ((ret = ds_retrieve_mem(LS_STATE_KEY, buf, &len)) != OK || len < sizeof(hdr)) {
+		LS_LOG_PRINTF(warn, "Failed to retrieve saved state: %d", ret);
+		free(buf);
+		return ret != OK ? ret : EINVAL;
+	}
+
+	memcpy(&hdr, buf, sizeof(hdr));
+	if (hdr.version != LS_STATE_VERSION) {
+		LS_LOG_PRINTF(warn, "Ignoring saved state of version %d", hdr.version);
+		free(buf);
+		return EINVAL;
+	}
+
+	if ((ret = ensure_initialized()) != OK) {
+		free(buf);
+		return ret;
+	}
+
+	const char* p = buf + sizeof(hdr);
+	const char* end = buf + len;
+	int same_ids = TRUE;
+
+	for (int i = 0; i < hdr.nloggers && end - p >= (int) sizeof(ls_saved_logger_t); i++) {
+		ls_saved_logger_t saved;
+
+		memcpy(&saved, p, sizeof(saved));
+		p += sizeof(saved);
+		saved.name[LS_MAX_LOGGER_NAME_LEN - 1] = '\0';
+
+		int spec_len = saved.template_len + saved.overrides_len;
+		if (spec_len < 0 || end - p < spec_len) {
+			break;
+		}
+
+		if (!lu_restore_logger(&saved, saved.template_len > 0 ? p : NULL)) {
+			same_ids = FALSE;
+		}
+		p += spec_len;
+	}
+
+	for (int i = 0; i < hdr.nformats && end - p >= (int) sizeof(int); i++) {
+		char text[LS_MAX_WRITEF_FORMAT_LEN];
+		int text_len;
+
+		memcpy(&text_len, p, sizeof(int));
+		p += sizeof(int);
+		if (text_len < 0 || text_len >= LS_MAX_WRITEF_FORMAT_LEN || end - p < text_len) {
+			break;
+		}
+
+		memcpy(text, p, text_len);
+		text[text_len] = '\0';
+		p += text_len;
+
+		if (format_register(text, NONE) != i + 1) {
+			LS_LOG_PRINTF(warn, "Format %d did not get its id back after restart", i + 1);
+		}
+	}
+
+	/* Handles are only honoured if they still point at the same loggers. */
+	g_config_generation = same_ids ? hdr.generation : hdr.generation + 1;
+	free(buf);
+
+	LS_LOG_PRINTF(info, "Restored state of %d loggers and %d formats", hdr.nloggers, hdr.nformats);
+	return lu_publish_state();
+}
+
+int sef_cb_init(int type, sef_init_info_t* UNUSED(info)) {
+	if (type != SEF_INIT_FRESH) {
+		/* ls can still start afresh if this fails. */
+		lu_restore_state();
+	}
+
+	return OK;
+}
+
+/* Writes out everything that is held back before the old instance goes
+ * away, including repeats and suppressed lines that have not been reported
+ * yet. This also replies to writers blocked by overflow = block. */
+int sef_cb_lu_prepare(int UNUSED(state)) {
+	for (ls_logger_list_t* l = g_config.loggers.head; l; l = l->tail) {
+		if (l->state.is_open) {
+			dedup_flush(l, l->state.opened_by);
+			flush_suppressed(l, l->state.opened_by);
+		}
+	}
+	queue_drain(-1);
+	subscribers_clear();
+
+	if (syslog_pending()) {
+		return ENOTREADY;
+	}
+
+	return OK;
+}
+
+int sef_cb_lu_state_save(int UNUSED(state)) {
+	return lu_publish_state();
+}
@@ -2,10 +2,8 @@
 #include <string.h>
 #include <lib.h>
 #include <minix/syslib.h>
-#include <time.h>
 #include <sys/errno.h>
 #include <limits.h>
-#include <minix/rs.h>
 #include "mini-printf.h"
 
 #define PUTC(c, ret) \
@@ -35,58 +33,241 @@ const char* severity_to_str(ls_severity_level_t severity) {
 	}
 }
 
-int lookup_proc(const char *name, endpoint_t *value)
-{
-	message m;
-	size_t len_key;
+/* Writes v in decimal, zero-padded to at least min_digits digits. */
+char* put_u64(char* pb, char* pend, u64_t v, int min_digits) {
+	char digits[20];
+	int n = 0;
 
-	len_key = strlen(name)+1;
+	do {
+		digits[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v || n < min_digits);
 
-	memset(&m, 0, sizeof(m));
-	m.m_rs_req.name = name;
-	m.m_rs_req.name_len = len_key;
+	while (n > 0) {
+		PUTC(digits[--n], pb);
+	}
+
+	return pb;
+}
+
+/* Date and time of the line in UTC, e.g. 2016-05-21 13:04:59, worked out from
+ * its TSC like %e rather than read from the RTC for every line. */
+char* put_time(char* pb, char* pend, u64_t tsc) {
+	u64_t secs = clock_epoch_ms(tsc) / 1000;
+	int64_t days = secs / 86400;
+	int sod = secs % 86400;
+
+	/* Days since the epoch to a civil date, counting in 400-year eras of
+	 * years that start in March, so that leap days come last. */
+	days += 719468;
+	int64_t era = days / 146097;
+	int doe = days - era * 146097;
+	int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	int mp = (5 * doy + 2) / 153;
+	int day = doy - (153 * mp + 2) / 5 + 1;
+	int month = mp < 10 ? mp + 3 : mp - 9;
+	u64_t year = yoe + era * 400 + (month <= 2);
+
+	pb = put_u64(pb, pend, year, 4);
+	PUTC('-', pb);
+	pb = put_u64(pb, pend, month, 2);
+	PUTC('-', pb);
+	pb = put_u64(pb, pend, day, 2);
+	PUTC(' ', pb);
+	pb = put_u64(pb, pend, sod / 3600, 2);
+	PUTC(':', pb);
+	pb = put_u64(pb, pend, sod / 60 % 60, 2);
+	PUTC(':', pb);
+	return put_u64(pb, pend, sod % 60, 2);
+}
+
+/* Uptime as seconds with a microsecond fraction, e.g. 1234.567890. */
+char* put_uptime(char* pb, char* pend, u64_t tsc) {
+	u64_t us = clock_uptime_us(tsc);
 
-	if (_syscall(RS_PROC_NR, RS_LOOKUP, &m) != -1) {
-		*value = m.m_rs_req.endpoint;
-		return OK;
+	pb = put_u64(pb, pend, us / 1000000, 1);
+	PUTC('.', pb);
+	return put_u64(pb, pend, us % 1000000, 6);
+}
+
+/* Reads a LEB128 varint of the field encoding (see minix_ls_write_kv in
+ * libc). Returns FALSE if the fields end in the middle of it. */
+int get_varint(const unsigned char** p, const unsigned char* end, u64_t* v) {
+	int shift = 0;
+
+	*v = 0;
+	while (*p < end && shift < 64) {
+		unsigned char c = *(*p)++;
+		*v |= (u64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80)) {
+			return TRUE;
+		}
+		shift += 7;
 	}
 
-	return -1;
+	return FALSE;
 }
 
-char* put_time(char* pb, char* pend) {
-	int r;
-	message m;
-	endpoint_t ep;
-	struct tm tm;
+int64_t unzigzag(u64_t v) {
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
 
-	r = lookup_proc("readclock.drv", &ep);
-	if (r != OK) {
-		LS_LOG_PRINTF(warn, "Couldn't locate readclock.drv: %d", r);
-		PUTS("unknown-time", pb);
-		return pb;
+char* put_i64(char* pb, char* pend, int64_t v) {
+	if (v < 0) {
+		PUTC('-', pb);
+		return put_u64(pb, pend, -(u64_t)v, 1);
+	}
+
+	return put_u64(pb, pend, v, 1);
+}
+
+char* put_hex(char* pb, char* pend, u64_t v) {
+	char digits[16];
+	int n = 0;
+
+	do {
+		digits[n++] = "0123456789abcdef"[v & 0xf];
+		v >>= 4;
+	} while (v);
+
+	PUTS("0x", pb);
+	while (n > 0) {
+		PUTC(digits[--n], pb);
 	}
 
-	memset(&m, 0, sizeof(m));
-	m.m_lc_readclock_rtcdev.tm = (vir_bytes)&tm;
-	m.m_lc_readclock_rtcdev.flags = RTCDEV_NOFLAGS;
+	return pb;
+}
+
+/* Strings are quoted when they would not read back as a single value. */
+char* put_string(char* pb, char* pend, const unsigned char* s, int len) {
+	int quote = len == 0;
+
+	for (int i = 0; i < len && !quote; i++) {
+		quote = s[i] <= ' ' || s[i] == '"' || s[i] == '=' || s[i] == '\\';
+	}
+
+	if (!quote) {
+		for (int i = 0; i < len; i++) {
+			PUTC(s[i], pb);
+		}
 
-	r = _syscall(ep, RTCDEV_GET_TIME, &m);
-	if (r != RTCDEV_REPLY || m.m_readclock_lc_rtcdev.status != 0) {
-		LS_LOG_PRINTF(warn, "Call to readclock.drv failed: %d", r);
-		PUTS("unknown-time", pb);
 		return pb;
 	}
 
-	char buffer[1024];
-	mini_snprintf(buffer, 1023, "%04d-%02d-%02d %02d:%02d:%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday + 1, tm.tm_hour, tm.tm_min, tm.tm_sec);
-	buffer[1023] = '\0';
+	PUTC('"', pb);
+	for (int i = 0; i < len; i++) {
+		if (s[i] == '"' || s[i] == '\\') {
+			PUTC('\\', pb);
+			PUTC(s[i], pb);
+		} else if (s[i] == '\n') {
+			PUTS("\\n", pb);
+		} else if (s[i] < ' ') {
+			PUTC('?', pb);
+		} else {
+			PUTC(s[i], pb);
+		}
+	}
+	PUTC('"', pb);
+
+	return pb;
+}
+
+/* Renders the fields of a minix_ls_write_kv line as key=value pairs separated
+ * by spaces. Rendering stops at the first field that does not decode. */
+char* put_fields(char* pb, char* pend, const char* fields, int fields_len) {
+	const unsigned char* p = (const unsigned char*) fields;
+	const unsigned char* end = p + fields_len;
+	int first = TRUE;
+
+	while (end - p >= 2) {
+		int type = p[0];
+		int key_len = p[1];
+		const unsigned char* key = p + 2;
+		u64_t v;
+
+		p += 2;
+		if (key_len == 0 || end - p < key_len) {
+			break;
+		}
+		p += key_len;
+
+		if (!get_varint(&p, end, &v)) {
+			break;
+		}
+
+		if (type == MINIX_LS_FIELD_STRING && (u64_t)(end - p) < v) {
+			break;
+		}
+
+		if (!first) {
+			PUTC(' ', pb);
+		}
+		first = FALSE;
+
+		for (int i = 0; i < key_len; i++) {
+			PUTC(key[i], pb);
+		}
+		PUTC('=', pb);
+
+		switch (type) {
+			case MINIX_LS_FIELD_INT:
+				pb = put_i64(pb, pend, unzigzag(v));
+				break;
+
+			case MINIX_LS_FIELD_HEX:
+				pb = put_hex(pb, pend, v);
+				break;
+
+			case MINIX_LS_FIELD_ENDPOINT: {
+				endpoint_t ep = (endpoint_t) unzigzag(v);
+				char procname[LS_IPC_LOGGER_MAX_NAME_LEN];
+
+				if (procname_from_pid(ep, procname, sizeof(procname))) {
+					PUTS(procname, pb);
+					PUTC('(', pb);
+					pb = put_i64(pb, pend, ep);
+					PUTC(')', pb);
+				} else {
+					pb = put_i64(pb, pend, ep);
+				}
+				break;
+			}
+
+			case MINIX_LS_FIELD_STRING:
+				pb = put_string(pb, pend, p, (int) v);
+				p += v;
+				break;
+
+			default:
+				PUTC('?', pb);
+				break;
+		}
+	}
 
-	PUTS(buffer, pb);
 	return pb;
 }
 
-int print_log(const char* format, const char* message, int msg_len, ls_severity_level_t severity, const char* procname, char* buffer, int buffer_len) {
+/* Whether the format places the fields itself with %k. */
+int format_has_fields(const char* format) {
+	while (*format) {
+		if (*format == '%') {
+			format++;
+			if (*format == 'k') {
+				return TRUE;
+			} else if (!*format) {
+				break;
+			}
+		}
+
+		format++;
+	}
+
+	return FALSE;
+}
+
+int print_log(const char* format, const char* message, int msg_len, const ls_line_info_t* info, char* buffer, int buffer_len) {
+	const char* format_start = format;
 	char *pb = buffer;
 	char *pend = buffer + buffer_len;
 
@@ -98,16 +279,25 @@ int print_log(const char* format, const char* message, int msg_len, ls_severity_
 			}
 
 			switch (*format) {
-				case 'l': PUTS(severity_to_str(severity), pb - pend); break;
-				case 't': pb = put_time(pb, pend); break;
-				case 'n': PUTS(procname, pb - buffer); break;
+				case 'l': PUTS(severity_to_str(info->severity), pb - buffer); break;
+				case 't': pb = put_time(pb, pend, info->tsc); break;
+				case 'T': pb = put_uptime(pb, pend, info->tsc); break;
+				case 'e': pb = put_u64(pb, pend, clock_epoch_ms(info->tsc), 1); break;
+				case 's': pb = put_u64(pb, pend, info->seq, 1); break;
+				case 'n': PUTS(info->procname, pb - buffer); break;
 				case 'm':
 					for (const char* pmsg = message; pmsg < message + msg_len; ++pmsg) {
 						PUTC(*pmsg, pb - buffer);
 					}
 
+					if (info->fields_len > 0 && !format_has_fields(format_start)) {
+						PUTC(' ', pb - buffer);
+						pb = put_fields(pb, pend, info->fields, info->fields_len);
+					}
 					break;
 
+				case 'k': pb = put_fields(pb, pend, info->fields, info->fields_len); break;
+
 				case '%': PUTC('%', pb - buffer); break;
 				default: PUTC('%', pb - buffer); PUTC(*format, pb - buffer); break;
 			}
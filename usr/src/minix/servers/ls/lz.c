@@ -0,0 +1,125 @@
+#include <string.h>
+#include "lz.h"
+
+/* A small LZ77 compressor for log blocks, built for speed rather than ratio:
+ * log lines repeat their prefixes, formats and messages, which a single hash
+ * probe per position finds well enough. The compressed stream is a sequence
+ * of tokens. A token byte below 0x80 is followed by that many plus one
+ * literal bytes. A token byte of 0x80 and up is a match: its low seven bits
+ * plus LZ_MIN_MATCH give the length, and the two bytes after it the distance
+ * back into the output, least significant byte first. */
+
+#define LZ_MIN_MATCH						4
+#define LZ_MAX_MATCH						(0x7f + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS						0x80
+#define LZ_MAX_DISTANCE						0xffff
+#define LZ_HASH_BITS						12
+
+/* Last position + 1 at which each hash of four bytes was seen. */
+uint16_t g_lz_table[1 << LZ_HASH_BITS];
+
+unsigned int lz_hash(const char* p) {
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Appends literal runs to dest. Returns the new length of dest, or -1 if they
+ * do not fit. */
+int lz_put_literals(const char* lit, int n, char* dest, int pos, int cap) {
+	while (n > 0) {
+		int run = n < LZ_MAX_LITERALS ? n : LZ_MAX_LITERALS;
+		if (pos + 1 + run > cap) {
+			return -1;
+		}
+
+		dest[pos++] = run - 1;
+		memcpy(dest + pos, lit, run);
+		pos += run;
+		lit += run;
+		n -= run;
+	}
+
+	return pos;
+}
+
+/* Compresses len bytes, which must be at most LS_LZ_BLOCK_SIZE. Returns the
+ * compressed length, or -1 if it would not fit in cap bytes. */
+int lz_compress(const char* src, int len, char* dest, int cap) {
+	int pos = 0;
+	int lit = 0;
+	int i = 0;
+
+	memset(g_lz_table, 0, sizeof(g_lz_table));
+
+	while (i + LZ_MIN_MATCH <= len) {
+		unsigned int h = lz_hash(src + i);
+		int cand = g_lz_table[h] - 1;
+		g_lz_table[h] = i + 1;
+
+		if (cand < 0 || i - cand > LZ_MAX_DISTANCE || memcmp(src + cand, src + i, LZ_MIN_MATCH) != 0) {
+			i++;
+			continue;
+		}
+
+		int n = LZ_MIN_MATCH;
+		while (n < LZ_MAX_MATCH && i + n < len && src[cand + n] == src[i + n]) {
+			n++;
+		}
+
+		if ((pos = lz_put_literals(src + lit, i - lit, dest, pos, cap)) < 0 || pos + 3 > cap) {
+			return -1;
+		}
+
+		dest[pos++] = 0x80 | (n - LZ_MIN_MATCH);
+		dest[pos++] = (i - cand) & 0xff;
+		dest[pos++] = (i - cand) >> 8;
+		i += n;
+		lit = i;
+	}
+
+	return lz_put_literals(src + lit, len - lit, dest, pos, cap);
+}
+
+/* Returns the decompressed length, or -1 if the data is corrupt or would not
+ * fit in cap bytes. */
+int lz_decompress(const char* src, int len, char* dest, int cap) {
+	const unsigned char* in = (const unsigned char*) src;
+	int pos = 0;
+	int i = 0;
+
+	while (i < len) {
+		int token = in[i++];
+
+		if (token < LZ_MAX_LITERALS) {
+			int run = token + 1;
+			if (i + run > len || pos + run > cap) {
+				return -1;
+			}
+
+			memcpy(dest + pos, in + i, run);
+			i += run;
+			pos += run;
+			continue;
+		}
+
+		if (i + 2 > len) {
+			return -1;
+		}
+
+		int n = (token & 0x7f) + LZ_MIN_MATCH;
+		int distance = in[i] | (in[i + 1] << 8);
+		i += 2;
+		if (distance == 0 || distance > pos || pos + n > cap) {
+			return -1;
+		}
+
+		/* Byte by byte, since a match may overlap what it produces. */
+		for (int k = 0; k < n; k++, pos++) {
+			dest[pos] = dest[pos - distance];
+		}
+	}
+
+	return pos;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Layout of files written by sinks with compress = lz, shared with lsdump.
+ * Such a file is a sequence of blocks, each holding up to LS_LZ_BLOCK_SIZE
+ * bytes of log text, and each starting with a header. Blocks are compressed
+ * on their own, so any block can be read without the ones before it; readers
+ * find the next block from the stored length in the header. */
+
+#define LS_LZ_MAGIC							0x7a4c534c /* "LSLz" */
+#define LS_LZ_BLOCK_SIZE					(32 * 1024)
+
+/* The block did not get any smaller, and is stored as it is. */
+#define LS_LZ_STORED						0x1
+
+typedef struct ls_lz_header_t {
+	uint32_t magic;
+	uint32_t flags;
+	uint32_t raw_len;
+	uint32_t stored_len;
+} ls_lz_header_t;
+
+int lz_compress(const char* src, int len, char* dest, int cap);
+int lz_decompress(const char* src, int len, char* dest, int cap);
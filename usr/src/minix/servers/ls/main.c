@@ -4,12 +4,19 @@
 
 /* SEF functions and variables. */
 void sef_local_startup(void);
+int sef_cb_init(int type, sef_init_info_t* info);
+int sef_cb_lu_prepare(int state);
+int sef_cb_lu_state_save(int state);
 
 int wait_request(message* msg, ls_request_t* req);
 
-ls_logger_list_t* g_loggers;
+ls_config_t g_config;
 int g_is_initialized;
 
+/* Bumped every time the config is parsed, so that handles given out for an
+ * earlier config are refused. */
+int g_config_generation;
+
 int valid_severity(int sev) {
 	switch (sev) {
 		case LS_SEV_TRACE:
@@ -23,6 +30,23 @@ int valid_severity(int sev) {
 	}
 }
 
+/* Requests after which the state kept for a restart has to be published
+ * again. */
+int changes_state(int type) {
+	switch (type) {
+		case LS_INITIALIZE:
+		case LS_START_LOG:
+		case LS_CLOSE_LOG:
+		case LS_SET_SEVERITY:
+		case LS_CREATE_LOGGER:
+		case LS_REGISTER_FORMAT:
+			return TRUE;
+
+		default:
+			return FALSE;
+	}
+}
+
 int main(int argc, char **argv)
 {
 	env_setargs(argc, argv);
@@ -30,31 +54,74 @@ int main(int argc, char **argv)
 
 	while (TRUE) {
 		uint16_t severity;
+		char logger_name[LS_IPC_LOGGER_MAX_NAME_LEN];
 		ls_request_t req;
+		ls_write_t w;
 		message m;
 		int result;
 
 		if (wait_request(&m, &req) != OK) {
 			result = EINVAL;
 		} else switch (req.type) {
+			case NOTIFY_MESSAGE:
+				if (req.source == CLOCK) {
+					queue_alarm();
+				}
+				result = EDONTREPLY;
+				break;
+
 			case LS_INITIALIZE:
 				result = do_initialize();
 				break;
 
 			case LS_START_LOG:
-				result = do_start_log(m.m_ls_start_log.logger, m.m_source);
+				/* The reply overlaps the logger name in the message. */
+				strncpy(logger_name, m.m_ls_start_log.logger, LS_IPC_LOGGER_MAX_NAME_LEN);
+				logger_name[LS_IPC_LOGGER_MAX_NAME_LEN - 1] = '\0';
+				memset(&m.m_ls_start_log_reply, 0, sizeof(m.m_ls_start_log_reply));
+				result = do_start_log(logger_name, m.m_source, &m.m_ls_start_log_reply);
 				break;
 
 			case LS_CLOSE_LOG:
-				result = do_close_log(m.m_ls_close_log.logger, m.m_source);
+				result = do_close_log(m.m_ls_close_log.logger, m.m_ls_close_log.filtered, m.m_ls_close_log.sampled, m.m_source);
 				break;
 
 			case LS_WRITE_LOG:
 				if (m.m_ls_write_log.message_len > LS_MAX_MESSAGE_LEN || !valid_severity(m.m_ls_write_log.severity)) {
 					result = EINVAL;
 				} else {
-					result = do_write_log(m.m_ls_write_log.logger, m.m_ls_write_log.severity, m.m_ls_write_log.message, m.m_ls_write_log.message_len, m.m_source);
+					w.severity = m.m_ls_write_log.severity;
+					w.msg = m.m_ls_write_log.message;
+					w.grant = GRANT_INVALID;
+					w.msg_len = m.m_ls_write_log.message_len;
+					w.format_id = 0;
+					w.tsc = 0;
+					w.local = FALSE;
+					result = do_write_log(m.m_ls_write_log.logger, &w, m.m_source);
+
+				}
+				break;
+
+			case LS_WRITE:
+				if (m.m_ls_write.message_len > LS_MAX_MESSAGE_LEN || !valid_severity(m.m_ls_write.severity)) {
+					result = EINVAL;
+				} else {
+					w.severity = m.m_ls_write.severity;
+					w.msg = m.m_ls_write.message;
+					w.grant = (m.m_ls_write.flags & LS_WRITE_GRANT) ? m.m_ls_write.grant : GRANT_INVALID;
+					w.msg_len = m.m_ls_write.message_len;
+					w.format_id = m.m_ls_write.format_id;
+					w.tsc = m.m_ls_write.tsc;
+					w.local = FALSE;
+					result = do_write(m.m_ls_write.handle, &w, m.m_ls_write.filtered, m.m_ls_write.sampled, m.m_source);
+				}
+				break;
 
+			case LS_WRITE_BATCH:
+				if (m.m_ls_write_batch.batch_len > MINIX_LS_MAX_BATCH_LEN) {
+					result = EINVAL;
+				} else {
+					result = do_write_batch(m.m_ls_write_batch.handle, (vir_bytes)m.m_ls_write_batch.batch, (m.m_ls_write_batch.flags & LS_WRITE_GRANT) ? m.m_ls_write_batch.grant : GRANT_INVALID, m.m_ls_write_batch.batch_len, m.m_ls_write_batch.filtered, m.m_ls_write_batch.sampled, m.m_source);
 				}
 				break;
 
@@ -76,6 +143,57 @@ int main(int argc, char **argv)
 				result = do_clear_logs();
 				break;
 
+			case LS_GET_STATS:
+				result = do_get_stats(m.m_ls_get_stats.logger, (vir_bytes)m.m_ls_get_stats.stats, m.m_source);
+				break;
+
+			case LS_CREATE_LOGGER:
+				strncpy(logger_name, m.m_ls_create_logger.logger, LS_IPC_LOGGER_MAX_NAME_LEN);
+				logger_name[LS_IPC_LOGGER_MAX_NAME_LEN - 1] = '\0';
+				result = do_create_logger(logger_name, (vir_bytes)m.m_ls_create_logger.spec, m.m_ls_create_logger.template_len, m.m_ls_create_logger.overrides_len, m.m_source);
+				break;
+
+			case LS_REGISTER_FORMAT:
+				if (m.m_ls_register_format.format_len >= LS_MAX_WRITEF_FORMAT_LEN) {
+					result = EINVAL;
+				} else {
+					vir_bytes format = (vir_bytes)m.m_ls_register_format.format;
+					int format_len = m.m_ls_register_format.format_len;
+					memset(&m.m_ls_register_format_reply, 0, sizeof(m.m_ls_register_format_reply));
+					result = do_register_format(format, format_len, m.m_source, &m.m_ls_register_format_reply);
+				}
+				break;
+
+			case LS_SUBSCRIBE:
+				severity = m.m_ls_subscribe.severity;
+				if (valid_severity(severity)) {
+					/* The reply overlaps the logger name in the message. */
+					strncpy(logger_name, m.m_ls_subscribe.logger, LS_IPC_LOGGER_MAX_NAME_LEN);
+					logger_name[LS_IPC_LOGGER_MAX_NAME_LEN - 1] = '\0';
+					memset(&m.m_ls_subscribe_reply, 0, sizeof(m.m_ls_subscribe_reply));
+					result = do_subscribe(logger_name, (ls_severity_level_t)severity, m.m_source, &m.m_ls_subscribe_reply);
+				} else {
+					result = EINVAL;
+				}
+				break;
+
+			case LS_READ_SUBSCRIPTION:
+				if (m.m_ls_read_subscription.buf_len > INT_MAX) {
+					result = EINVAL;
+				} else {
+					int id = m.m_ls_read_subscription.subscription;
+					vir_bytes buf = (vir_bytes)m.m_ls_read_subscription.buf;
+					cp_grant_id_t grant = (m.m_ls_read_subscription.flags & LS_READ_GRANT) ? m.m_ls_read_subscription.grant : GRANT_INVALID;
+					int buf_len = m.m_ls_read_subscription.buf_len;
+					memset(&m.m_ls_read_subscription_reply, 0, sizeof(m.m_ls_read_subscription_reply));
+					result = do_read_subscription(id, buf, grant, buf_len, m.m_source, &m.m_ls_read_subscription_reply);
+				}
+				break;
+
+			case LS_UNSUBSCRIBE:
+				result = do_unsubscribe(m.m_ls_unsubscribe.subscription, m.m_source);
+				break;
+
 			default:
 				result = EINVAL;
 				break;
@@ -85,6 +203,17 @@ int main(int argc, char **argv)
 			m.m_type = result;
 			reply(req.source, &m);
 		}
+
+		if (result == OK && changes_state(req.type)) {
+			lu_state_changed();
+			queue_arm();
+		}
+
+		/* Only now that the client has its reply, write out some of what
+		 * it (and everyone else) asked for. */
+		if (queue_pending()) {
+			queue_service(LS_DRAIN_PER_REQUEST);
+		}
 	}
 
 	return OK;
@@ -92,18 +221,32 @@ int main(int argc, char **argv)
 
 void sef_local_startup()
 {
+	sef_setcb_init_fresh(sef_cb_init);
+	sef_setcb_init_lu(sef_cb_init);
+	sef_setcb_init_restart(sef_cb_init);
+
+	sef_setcb_lu_prepare(sef_cb_lu_prepare);
+	sef_setcb_lu_state_isvalid(sef_cb_lu_state_isvalid_standard);
+	sef_setcb_lu_state_save(sef_cb_lu_state_save);
+
 	sef_startup();
 }
 
 int wait_request(message *msg, ls_request_t *req)
 {
-	int status = sef_receive(ANY, msg);
+	int ipc_status;
+	int status = sef_receive_status(ANY, msg, &ipc_status);
 	if (OK != status) {
 		LS_LOG_PRINTF(warn, "Failed to receive message from pid %d: %d", msg->m_source, status);
 		return status;
 	}
 
 	req->source = msg->m_source;
+	if (is_ipc_notify(ipc_status)) {
+		req->type = NOTIFY_MESSAGE;
+		return OK;
+	}
+
 	if (msg->m_type < LS_BASE || msg->m_type >= LS_END) {
 		LS_LOG_PRINTF(warn, "Invalid message type %d from pid %d", msg->m_type, msg->m_source);
 		return -1;
@@ -137,15 +280,19 @@ void reply(endpoint_t destination, message *msg) {
 }
 
 ls_logger_list_t* find_logger(const char* logger) {
-	if (!g_loggers) {
-		return NULL;
-	}
+	return registry_find(&g_config.loggers, logger);
+}
 
-	for (ls_logger_list_t* l = g_loggers; l; l = l->tail) {
-		if (strcmp(l->logger.name, logger) == 0) {
-			return l;
-		}
+/* Handles are the logger's id in the registry, tagged with the generation of
+ * the config it was parsed from. */
+int make_handle(const ls_logger_list_t* l) {
+	return ((g_config_generation & 0x7ff) << LS_HANDLE_ID_BITS) | l->id;
+}
+
+ls_logger_list_t* find_logger_by_handle(int handle) {
+	if (handle < 0 || (handle >> LS_HANDLE_ID_BITS) != (g_config_generation & 0x7ff)) {
+		return NULL;
 	}
 
-	return NULL;
+	return registry_get(&g_config.loggers, handle & ((1 << LS_HANDLE_ID_BITS) - 1));
 }
@@ -5,6 +5,7 @@
 #include <minix/ipc.h>
 #include <minix/com.h>
 #include <stdlib.h>
+#include <minix/ls.h>
 
 #define LS_MAX_LOGGER_NAME_LEN              32
 #define LS_MAX_LOGGER_LOGFILE_PATH_LEN      64
@@ -12,6 +13,31 @@
 #define LS_MAX_PROC_NAME_LEN				2048
 #define LS_ERR_BUF_LEN						1024
 #define LS_MAX_MESSAGE_LEN					2048
+#define LS_MAX_OVERRIDES_LEN				1024
+#define LS_DEFAULT_MAX_DYNAMIC_LOGGERS		32
+#define LS_DEDUP_FLUSH_REPEATS				1000
+#define LS_MAX_SAMPLE_EVERY					65535
+#define LS_HANDLE_ID_BITS					20
+#define LS_MAX_SINKS						4
+#define LS_MAX_SINK_NAME_LEN				16
+#define LS_SYSLOG_BATCH_LEN					4096
+#define LS_DEFAULT_MAX_PENDING_BYTES		(256 * 1024)
+#define LS_DRAIN_PER_REQUEST				4
+#define LS_DRAIN_BATCH						256
+#define LS_DRAIN_TICKS						1
+#define LS_DEFAULT_HIGH_WATERMARK			(64 * 1024)
+#define LS_MAX_FORMATS						512
+#define LS_MAX_FORMATS_PER_CLIENT			64
+#define LS_MAX_WRITEF_FORMAT_LEN			256
+#define LS_MAX_FORMAT_ARGS					16
+#define LS_FILE_BUFSIZE						8192
+#define LS_MAX_FILE_BUFSIZE					(1024 * 1024)
+#define LS_END_SUFFIX						".end"
+#define LS_LZ_BLOCK_SECS					1
+#define LS_STATE_PUBLISH_SECS				1
+#define LS_MAX_SUBSCRIBERS					16
+#define LS_SUBSCRIBER_BUFSIZE				(64 * 1024)
+#define LS_MAX_SUBSCRIPTIONS_PER_CLIENT		4
 
 #define LS_LOG_PRINTF(level, fmt, ...) \
 	do { \
@@ -40,7 +66,9 @@ typedef struct ls_request_t {
 typedef enum ls_log_destination_t {
 	LS_DESTINATION_FILE,
 	LS_DESTINATION_STDERR,
-	LS_DESTINATION_STDOUT
+	LS_DESTINATION_STDOUT,
+	LS_DESTINATION_SYSLOG,
+	LS_DESTINATION_NONE
 } ls_log_destination_t;
 
 typedef enum ls_severity_level_t {
@@ -50,51 +78,275 @@ typedef enum ls_severity_level_t {
 	LS_SEV_WARN
 } ls_severity_level_t;
 
-typedef struct ls_logger_t {
-	char name[LS_MAX_LOGGER_NAME_LEN];
+#define LS_NUM_SEVERITIES					4
+
+typedef enum ls_overflow_policy_t {
+	LS_OVERFLOW_NONE,
+	LS_OVERFLOW_BLOCK,
+	LS_OVERFLOW_DROP_NEWEST,
+	LS_OVERFLOW_DROP_OLDEST
+} ls_overflow_policy_t;
+
+typedef enum ls_compression_t {
+	LS_COMPRESS_NONE,
+	LS_COMPRESS_LZ
+} ls_compression_t;
+
+/* One destination of a logger. The first sink is set up by the plain
+ * `destination`, `filename`, `format` and `append` options, any others by the
+ * same options with the sink's name as a suffix, e.g. `destination.console`.
+ * A sink only gets lines at or above its own severity, on top of the logger's
+ * severity. */
+typedef struct ls_sink_t {
+	char name[LS_MAX_SINK_NAME_LEN];
 	ls_log_destination_t dest_type;
 	ls_severity_level_t severity;
 	char dest_filename[LS_MAX_LOGGER_LOGFILE_PATH_LEN];
 	char format[LS_MAX_LOGGER_FORMAT_LEN];
 	int append;
+	int buffer;
+	ls_compression_t compress;
+	int index;
+	int facility;
+} ls_sink_t;
+
+typedef struct ls_logger_t {
+	char name[LS_MAX_LOGGER_NAME_LEN];
+	ls_severity_level_t severity;
+	ls_sink_t sinks[LS_MAX_SINKS];
+	int nsinks;
+	int rate;
+	int burst;
+	int dedup;
+	int sample_every[LS_NUM_SEVERITIES];
+	ls_overflow_policy_t overflow;
+	int high_watermark;
+	int low_watermark;
 } ls_logger_t;
 
+typedef struct ls_bucket_t {
+	int rate;
+	int burst;
+	u64_t credit;
+	clock_t last;
+	int primed;
+} ls_bucket_t;
+
 typedef struct ls_logger_state_t {
 	int is_open;
 	ls_severity_level_t severity;
 	endpoint_t opened_by;
-	int fd;
-	char opened_by_name[LS_MAX_PROC_NAME_LEN];
-	char msg_buf[LS_MAX_MESSAGE_LEN];
+	struct ls_file_t* file[LS_MAX_SINKS];
+	unsigned int file_writes[LS_MAX_SINKS];
+	unsigned int file_syncs[LS_MAX_SINKS];
+
+	ls_bucket_t bucket;
+	unsigned int suppressed;
+
+	int dedup_valid;
+	u64_t dedup_hash;
+	int dedup_len;
+	ls_severity_level_t dedup_severity;
+	unsigned int repeats;
+
+	struct ls_pending_t* pending_head;
+	struct ls_pending_t* pending_tail;
+	int pending_bytes;
+	int overflowing;
+	int is_blocked;
+	endpoint_t blocked_who;
+
+	/* Numbers the lines the logger has emitted, for %s. */
+	unsigned int seq;
+
+	minix_ls_stats_t stats;
 } ls_logger_state_t;
 
+/* A line as sent by a client. msg is in the client's address space, or
+ * behind grant if that is not GRANT_INVALID, unless the line came in a batch
+ * and has already been copied in. */
+typedef struct ls_write_t {
+	ls_severity_level_t severity;
+	char* msg;
+	cp_grant_id_t grant;
+	int msg_len;
+	int format_id;
+	u64_t tsc;
+	int local;
+} ls_write_t;
+
+/* What print_log needs to know about a line besides its message. */
+typedef struct ls_line_info_t {
+	ls_severity_level_t severity;
+	const char* procname;
+	u64_t tsc;
+	unsigned int seq;
+	const char* fields;
+	int fields_len;
+} ls_line_info_t;
+
 typedef struct ls_logger_list_t {
 	ls_logger_t logger;
 	ls_logger_state_t state;
 	struct ls_logger_list_t* tail;
+
+	/* What a logger made by do_create_logger was made from: the template
+	 * name followed by the overrides. Kept so it can be made again after ls
+	 * is restarted. */
+	char* spec;
+	int template_len;
+	int overrides_len;
+
+	int id;
+	unsigned int hash;
+	struct ls_logger_list_t* hash_next;
 } ls_logger_list_t;
 
+typedef struct ls_registry_t {
+	ls_logger_list_t* head;
+	ls_logger_list_t* last;
+	ls_logger_list_t** buckets;
+	unsigned int nbuckets;
+	ls_logger_list_t** by_id;
+	int ids_cap;
+	int count;
+} ls_registry_t;
+
+typedef struct ls_settings_t {
+	int max_dynamic_loggers;
+	int sender_rate;
+	int sender_burst;
+	int max_pending_bytes;
+	int preallocate;
+} ls_settings_t;
+
+typedef struct ls_config_t {
+	ls_registry_t loggers;
+	ls_registry_t templates;
+	ls_settings_t settings;
+} ls_config_t;
+
 /* Function prototypes. */
 
 /* main.c */
-extern ls_logger_list_t* g_loggers;
+extern ls_config_t g_config;
 extern int g_is_initialized;
+extern int g_config_generation;
 
 int main(int argc, char **argv);
 void reply(endpoint_t destination, message* msg);
 
 ls_logger_list_t* find_logger(const char* logger);
+ls_logger_list_t* find_logger_by_handle(int handle);
+int make_handle(const ls_logger_list_t* l);
 int ensure_initialized();
+int valid_severity(int sev);
 
 /* requests.c */
 int do_initialize();
-int do_start_log(const char* logger, endpoint_t who);
-int do_close_log(const char* logger, endpoint_t who);
-int do_write_log(const char* logger, ls_severity_level_t severity, char* msg, int msg_len, endpoint_t who);
+int do_start_log(const char* logger, endpoint_t who, mess_ls_start_log_reply* reply);
+int do_close_log(const char* logger, unsigned int filtered, unsigned int sampled, endpoint_t who);
+int do_write_log(const char* logger, const ls_write_t* w, endpoint_t who);
+int do_write(int handle, const ls_write_t* w, unsigned int filtered, unsigned int sampled, endpoint_t who);
+int do_write_batch(int handle, vir_bytes batch, cp_grant_id_t grant, int batch_len, unsigned int filtered, unsigned int sampled, endpoint_t who);
+int do_register_format(vir_bytes format, int format_len, endpoint_t who, mess_ls_register_format_reply* reply);
 int do_clear_log(const char* logger);
 int do_set_severity(const char* logger, ls_severity_level_t severity);
 int do_clear_logs();
+int do_create_logger(const char* logger, vir_bytes spec, int template_len, int overrides_len, endpoint_t who);
+int do_get_stats(const char* logger, vir_bytes stats, endpoint_t who);
+int write_line(ls_logger_list_t* l, ls_severity_level_t severity, unsigned int sinks, int first, u64_t tsc, char* buf, int sz);
+int emit_line(ls_logger_list_t* l, ls_severity_level_t severity, const char* msg, int msg_len, u64_t tsc, endpoint_t who);
+int flush_suppressed(ls_logger_list_t* l, endpoint_t who);
+void suppressed_alarm();
+int suppressed_pending();
+int procname_from_pid(endpoint_t pid, char* buffer, int buffer_len);
+int open_sinks(ls_logger_list_t* l, int reopen);
+void count_sinks(ls_logger_list_t* l);
+void close_sinks(ls_logger_list_t* l);
+int create_logger(const char* logger, const char* spec, int template_len, int overrides_len);
+
+/* ratelimit.c */
+void ratelimit_init();
+void bucket_init(ls_bucket_t* b, int rate, int burst);
+int ratelimit_allow(ls_logger_list_t* l, endpoint_t who);
+int ratelimit_ready(ls_logger_list_t* l, endpoint_t who);
+
+/* registry.c */
+unsigned int hash_name(const char* name);
+void registry_init(ls_registry_t* reg);
+ls_logger_list_t* registry_find(const ls_registry_t* reg, const char* name);
+ls_logger_list_t* registry_get(const ls_registry_t* reg, int id);
+int registry_insert(ls_registry_t* reg, ls_logger_list_t* l);
+void registry_free(ls_registry_t* reg);
+
+/* queue.c */
+int queue_line(ls_logger_list_t* l, ls_severity_level_t severity, unsigned int sinks, int first, u64_t tsc, const char* buf, int sz);
+int queue_pending();
+void queue_drain(int budget);
+void queue_service(int budget);
+void queue_arm();
+void queue_alarm();
+int queue_block(ls_logger_list_t* l, endpoint_t who);
+
+/* files.c */
+struct ls_file_t* file_open(const ls_sink_t* sink, int truncate);
+int file_write(struct ls_file_t* f, const char* line, int len);
+void file_index_line(struct ls_file_t* f, ls_severity_level_t severity, u64_t tsc);
+int file_close(struct ls_file_t* f);
+void file_counts(const struct ls_file_t* f, unsigned int* writes, unsigned int* syncs);
+void files_flush();
+void files_tick();
+void files_sync();
+int files_pending();
+
+/* console.c */
+int console_write(ls_log_destination_t dest, const char* line, int len);
+void console_flush();
+int console_pending();
+
+/* syslog.c */
+int syslog_append(int facility, ls_severity_level_t severity, const char* line, int len);
+int syslog_flush();
+int syslog_pending();
+
+/* sample.c */
+int sample_keep(const ls_logger_list_t* l, ls_severity_level_t severity);
+
+/* dedup.c */
+u64_t hash_message(ls_severity_level_t severity, const char* msg, int msg_len);
+int dedup_is_repeat(const ls_logger_list_t* l, u64_t hash, int msg_len);
+void dedup_remember(ls_logger_list_t* l, u64_t hash, int msg_len, ls_severity_level_t severity);
+int dedup_flush(ls_logger_list_t* l, endpoint_t who);
+
+/* clock.c */
+int clock_init();
+u64_t clock_uptime_us(u64_t tsc);
+u64_t clock_epoch_ms(u64_t tsc);
+u32_t clock_tsc_khz();
+
+/* formats.c */
+int format_register(const char* text, endpoint_t owner);
+int format_render(int id, const char* args, int args_len, char* buffer, int buffer_len);
+int format_count();
+const char* format_text(int id);
+
+/* subscribe.c */
+void subscribers_publish(ls_logger_list_t* l, ls_severity_level_t severity, const char* line, int len);
+void subscribers_clear();
+int do_subscribe(const char* logger, ls_severity_level_t severity, endpoint_t who, mess_ls_subscribe_reply* reply);
+int do_read_subscription(int id, vir_bytes buf, cp_grant_id_t grant, int buf_len, endpoint_t who, mess_ls_read_subscription_reply* reply);
+int do_unsubscribe(int id, endpoint_t who);
+
+/* liveupdate.c */
+int lu_publish_state();
+void lu_state_changed();
+int lu_state_pending();
+void lu_state_alarm();
+int lu_restore_state();
 
 /* log.h */
 const char* severity_to_str(ls_severity_level_t severity);
-int print_log(const char* format, const char* message, int msg_len, ls_severity_level_t severity, const char* procname, char* buffer, int buffer_len);
+int get_varint(const unsigned char** p, const unsigned char* end, u64_t* v);
+int64_t unzigzag(u64_t v);
+int print_log(const char* format, const char* message, int msg_len, const ls_line_info_t* info, char* buffer, int buffer_len);
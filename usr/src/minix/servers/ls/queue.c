@@ -0,0 +1,283 @@
+#include <sys/errno.h>
+#include "proto.h"
+#include "mini-printf.h"
+#include <minix/syslib.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Lines that have been accepted and formatted, but not yet written out. The
+ * client gets its reply as soon as the line is queued; the queues are drained
+ * a few lines after every request, and in larger batches on a timer when ls
+ * has nothing else to do. Console output collected while draining is handed
+ * to the kernel on the timer, or when the queues are drained completely, so
+ * a busy logger reaches the kernel in screenfuls rather than a line per
+ * request; file buffers that have not filled up are written out and synced
+ * at the same times. There is one FIFO per severity, and the highest
+ * severity is always written first, so a warning never waits behind a flood
+ * of trace lines. When the queued lines take up more than max_pending_bytes,
+ * the oldest lines of the lowest severity are shed to make room.
+ *
+ * Every line is also linked into a FIFO of its logger, which is what the
+ * logger's overflow policy works on once the logger has more than its high
+ * watermark queued: new lines are dropped, old lines are dropped, or the
+ * writer is not replied to until the logger is back under its low
+ * watermark. */
+
+typedef struct ls_pending_t {
+	struct ls_pending_t* next;
+	struct ls_pending_t* prev;
+	struct ls_pending_t* logger_next;
+	struct ls_pending_t* logger_prev;
+	ls_logger_list_t* logger;
+	ls_severity_level_t severity;
+	unsigned int sinks;
+	int first;
+	u64_t tsc;
+	int len;
+	char line[];
+} ls_pending_t;
+
+typedef struct ls_queue_t {
+	ls_pending_t* head;
+	ls_pending_t* tail;
+} ls_queue_t;
+
+ls_queue_t g_queues[LS_NUM_SEVERITIES];
+int g_pending_bytes;
+int g_alarm_set;
+
+/* Called whenever lines of the logger leave the queue. */
+void queue_below_low(ls_logger_list_t* l) {
+	message m;
+
+	if (l->state.pending_bytes > l->logger.low_watermark) {
+		return;
+	}
+
+	l->state.overflowing = FALSE;
+	if (l->state.is_blocked) {
+		l->state.is_blocked = FALSE;
+
+		memset(&m, 0, sizeof(m));
+		m.m_type = OK;
+		reply(l->state.blocked_who, &m);
+	}
+}
+
+void queue_unlink(ls_pending_t* p) {
+	ls_queue_t* q = &g_queues[p->severity];
+	ls_logger_state_t* st = &p->logger->state;
+
+	if (p->prev) {
+		p->prev->next = p->next;
+	} else {
+		q->head = p->next;
+	}
+	if (p->next) {
+		p->next->prev = p->prev;
+	} else {
+		q->tail = p->prev;
+	}
+
+	if (p->logger_prev) {
+		p->logger_prev->logger_next = p->logger_next;
+	} else {
+		st->pending_head = p->logger_next;
+	}
+	if (p->logger_next) {
+		p->logger_next->logger_prev = p->logger_prev;
+	} else {
+		st->pending_tail = p->logger_prev;
+	}
+
+	g_pending_bytes -= p->len;
+	st->pending_bytes -= p->len;
+	queue_below_low(p->logger);
+}
+
+/* Drops the oldest line of the lowest severity that is below the given one.
+ * Returns FALSE if there is no such line. */
+int queue_shed(ls_severity_level_t below) {
+	for (int sev = LS_SEV_TRACE; sev < (int)below; sev++) {
+		ls_pending_t* p = g_queues[sev].head;
+		if (p) {
+			if (p->first) {
+				p->logger->state.stats.shed++;
+			}
+			queue_unlink(p);
+			free(p);
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/* Applies the drop_newest and drop_oldest policies. Returns FALSE if the new
+ * line has to be dropped. Lines that are queued more than once, because the
+ * logger's sinks have different formats, are counted once. */
+int queue_make_room(ls_logger_list_t* l, int first, int sz) {
+	ls_logger_state_t* st = &l->state;
+
+	if (l->logger.overflow != LS_OVERFLOW_DROP_NEWEST && l->logger.overflow != LS_OVERFLOW_DROP_OLDEST) {
+		return TRUE;
+	}
+
+	if (st->pending_bytes > 0 && st->pending_bytes + sz > l->logger.high_watermark) {
+		st->overflowing = TRUE;
+	}
+
+	if (!st->overflowing) {
+		return TRUE;
+	}
+
+	if (l->logger.overflow == LS_OVERFLOW_DROP_NEWEST) {
+		st->stats.dropped += first;
+		return FALSE;
+	}
+
+	while (st->pending_head && st->pending_bytes + sz > l->logger.low_watermark) {
+		ls_pending_t* p = st->pending_head;
+		st->stats.dropped += p->first;
+		queue_unlink(p);
+		free(p);
+	}
+	st->overflowing = FALSE;
+
+	return TRUE;
+}
+
+int queue_line(ls_logger_list_t* l, ls_severity_level_t severity, unsigned int sinks, int first, u64_t tsc, const char* buf, int sz) {
+	if (!queue_make_room(l, first, sz)) {
+		return OK;
+	}
+
+	while (g_pending_bytes > 0 && g_pending_bytes + sz > g_config.settings.max_pending_bytes) {
+		if (!queue_shed(severity)) {
+			l->state.stats.shed += first;
+			return OK;
+		}
+	}
+
+	ls_pending_t* p = malloc(sizeof(ls_pending_t) + sz + 1);
+	if (!p) {
+		LS_LOG_PRINTF(warn, "Out of memory queueing a line for logger '%s'", l->logger.name);
+		l->state.stats.shed += first;
+		return ENOMEM;
+	}
+
+	p->logger = l;
+	p->severity = severity;
+	p->sinks = sinks;
+	p->first = first;
+	p->tsc = tsc;
+	p->len = sz;
+	memcpy(p->line, buf, sz);
+	p->line[sz] = '\0';
+
+	ls_queue_t* q = &g_queues[severity];
+	p->next = NULL;
+	p->prev = q->tail;
+	if (q->tail) {
+		q->tail->next = p;
+	} else {
+		q->head = p;
+	}
+	q->tail = p;
+
+	p->logger_next = NULL;
+	p->logger_prev = l->state.pending_tail;
+	if (l->state.pending_tail) {
+		l->state.pending_tail->logger_next = p;
+	} else {
+		l->state.pending_head = p;
+	}
+	l->state.pending_tail = p;
+
+	g_pending_bytes += sz;
+	l->state.pending_bytes += sz;
+
+	return OK;
+}
+
+/* Holds back the reply to a writer whose logger is over its high watermark
+ * with overflow = block. The reply is sent once the logger drains below its
+ * low watermark. */
+int queue_block(ls_logger_list_t* l, endpoint_t who) {
+	if (l->logger.overflow != LS_OVERFLOW_BLOCK || l->state.pending_bytes <= l->logger.high_watermark) {
+		return FALSE;
+	}
+
+	l->state.is_blocked = TRUE;
+	l->state.blocked_who = who;
+	l->state.stats.blocked++;
+
+	return TRUE;
+}
+
+int queue_pending() {
+	for (int sev = 0; sev < LS_NUM_SEVERITIES; sev++) {
+		if (g_queues[sev].head) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/* Writes out at most budget lines, highest severity first. A negative budget
+ * writes out everything, console output and file buffers included. */
+void queue_drain(int budget) {
+	for (int sev = LS_SEV_WARN; sev >= LS_SEV_TRACE && budget != 0; sev--) {
+		ls_pending_t* p;
+		while (budget != 0 && (p = g_queues[sev].head)) {
+			queue_unlink(p);
+			write_line(p->logger, p->severity, p->sinks, p->first, p->tsc, p->line, p->len);
+			free(p);
+			budget--;
+		}
+	}
+
+	syslog_flush();
+	if (budget < 0) {
+		console_flush();
+		files_flush();
+		files_sync();
+	}
+}
+
+/* Keeps the alarm armed for as long as there is something left to write,
+ * including console output, file buffers and files to sync, summaries of
+ * suppressed lines, records that syslogd has not taken yet, and state to
+ * publish for a restart. */
+void queue_arm() {
+	int ret;
+
+	if ((queue_pending() || console_pending() || files_pending() || syslog_pending() ||
+			suppressed_pending() || lu_state_pending()) && !g_alarm_set) {
+		if ((ret = sys_setalarm(LS_DRAIN_TICKS, 0)) != OK) {
+			LS_LOG_PRINTF(warn, "Failed to set alarm, writing out all queued lines: %d", ret);
+			queue_drain(-1);
+			return;
+		}
+
+		g_alarm_set = TRUE;
+	}
+}
+
+/* Called after every request. */
+void queue_service(int budget) {
+	queue_drain(budget);
+	queue_arm();
+}
+
+void queue_alarm() {
+	g_alarm_set = FALSE;
+	suppressed_alarm();
+	queue_drain(LS_DRAIN_BATCH);
+	console_flush();
+	files_tick();
+	files_sync();
+	lu_state_alarm();
+	queue_arm();
+}
@@ -0,0 +1,117 @@
+#include "proto.h"
+#include <minix/endpoint.h>
+#include <minix/sysutil.h>
+
+/* Token buckets for rate limiting. Credit is kept in units of 1/hz of a line,
+ * so refilling a bucket from an elapsed tick count is a single multiplication
+ * and taking a line out of it is a subtraction of hz. */
+
+typedef struct ls_sender_t {
+	endpoint_t endpoint;
+	ls_bucket_t bucket;
+} ls_sender_t;
+
+/* Per-sender buckets, indexed by process slot. A slot that gets reused by a
+ * new process starts over with a full bucket. */
+ls_sender_t g_senders[NR_PROCS];
+u32_t g_hz;
+
+void ratelimit_init() {
+	g_hz = sys_hz();
+	for (int i = 0; i < NR_PROCS; i++) {
+		g_senders[i].endpoint = NONE;
+	}
+}
+
+void bucket_init(ls_bucket_t* b, int rate, int burst) {
+	b->rate = rate;
+	b->burst = burst;
+	b->credit = (u64_t)burst * g_hz;
+	b->last = 0;
+	b->primed = FALSE;
+}
+
+void bucket_refill(ls_bucket_t* b, clock_t now) {
+	if (!b || !b->rate) {
+		return;
+	}
+
+	if (b->primed) {
+		u64_t max = (u64_t)b->burst * g_hz;
+		b->credit += (u64_t)(now - b->last) * b->rate;
+		if (b->credit > max) {
+			b->credit = max;
+		}
+	}
+
+	b->last = now;
+	b->primed = TRUE;
+}
+
+int bucket_ready(const ls_bucket_t* b) {
+	return !b || !b->rate || b->credit >= g_hz;
+}
+
+void bucket_consume(ls_bucket_t* b) {
+	if (b && b->rate) {
+		b->credit -= g_hz;
+	}
+}
+
+ls_bucket_t* sender_bucket(endpoint_t who) {
+	int slot = _ENDPOINT_P(who);
+	if (!g_config.settings.sender_rate || slot < 0 || slot >= NR_PROCS) {
+		return NULL;
+	}
+
+	ls_sender_t* sender = &g_senders[slot];
+	if (sender->endpoint != who) {
+		sender->endpoint = who;
+		bucket_init(&sender->bucket, g_config.settings.sender_rate, g_config.settings.sender_burst);
+	}
+
+	return &sender->bucket;
+}
+
+/* Returns TRUE if a line from `who` to logger `l` would fit in both rate
+ * limits now, without taking it out of the buckets. */
+int ratelimit_ready(ls_logger_list_t* l, endpoint_t who) {
+	clock_t now;
+	ls_bucket_t* lb = l->state.bucket.rate ? &l->state.bucket : NULL;
+	ls_bucket_t* sb = sender_bucket(who);
+
+	if (getticks(&now) != OK) {
+		return TRUE;
+	}
+
+	bucket_refill(lb, now);
+	bucket_refill(sb, now);
+	return bucket_ready(lb) && bucket_ready(sb);
+}
+
+/* Decides whether a line from `who` to logger `l` fits in both the logger's
+ * and the sender's rate limit, and takes it out of both buckets if so. */
+int ratelimit_allow(ls_logger_list_t* l, endpoint_t who) {
+	clock_t now;
+	ls_bucket_t* lb = l->state.bucket.rate ? &l->state.bucket : NULL;
+	ls_bucket_t* sb = sender_bucket(who);
+
+	if (!lb && !sb) {
+		return TRUE;
+	}
+
+	if (getticks(&now) != OK) {
+		return TRUE;
+	}
+
+	bucket_refill(lb, now);
+	bucket_refill(sb, now);
+	if (!bucket_ready(lb) || !bucket_ready(sb)) {
+		return FALSE;
+	}
+
+	bucket_consume(lb);
+	bucket_consume(sb);
+
+	return TRUE;
+}
@@ -0,0 +1,124 @@
+#include "proto.h"
+#include <string.h>
+#include <malloc.h>
+#include <sys/errno.h>
+
+/* Name -> logger index. Loggers are also kept on a singly linked list in the
+ * order they were defined, which is what all iteration goes through; the hash
+ * table only serves lookups by name. Each logger also gets a small id, its
+ * position in that order, which clients use in handles. */
+
+#define REGISTRY_MIN_BUCKETS     64
+
+unsigned int hash_name(const char* name) {
+	/* FNV-1a */
+	unsigned int h = 2166136261u;
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+int registry_grow(ls_registry_t* reg) {
+	unsigned int nbuckets = reg->nbuckets ? reg->nbuckets * 2 : REGISTRY_MIN_BUCKETS;
+	ls_logger_list_t** buckets = calloc(nbuckets, sizeof(ls_logger_list_t*));
+	if (!buckets) {
+		return ENOMEM;
+	}
+
+	for (ls_logger_list_t* l = reg->head; l; l = l->tail) {
+		unsigned int b = l->hash & (nbuckets - 1);
+		l->hash_next = buckets[b];
+		buckets[b] = l;
+	}
+
+	free(reg->buckets);
+	reg->buckets = buckets;
+	reg->nbuckets = nbuckets;
+
+	return OK;
+}
+
+void registry_init(ls_registry_t* reg) {
+	memset(reg, 0, sizeof(ls_registry_t));
+}
+
+ls_logger_list_t* registry_find(const ls_registry_t* reg, const char* name) {
+	if (!reg->nbuckets) {
+		return NULL;
+	}
+
+	unsigned int h = hash_name(name);
+	for (ls_logger_list_t* l = reg->buckets[h & (reg->nbuckets - 1)]; l; l = l->hash_next) {
+		if (l->hash == h && strcmp(l->logger.name, name) == 0) {
+			return l;
+		}
+	}
+
+	return NULL;
+}
+
+int registry_grow_ids(ls_registry_t* reg) {
+	int cap = reg->ids_cap ? reg->ids_cap * 2 : REGISTRY_MIN_BUCKETS;
+	ls_logger_list_t** by_id = realloc(reg->by_id, cap * sizeof(ls_logger_list_t*));
+	if (!by_id) {
+		return ENOMEM;
+	}
+
+	reg->by_id = by_id;
+	reg->ids_cap = cap;
+
+	return OK;
+}
+
+ls_logger_list_t* registry_get(const ls_registry_t* reg, int id) {
+	if (id < 0 || id >= reg->count) {
+		return NULL;
+	}
+
+	return reg->by_id[id];
+}
+
+int registry_insert(ls_registry_t* reg, ls_logger_list_t* l) {
+	if ((unsigned int)reg->count >= reg->nbuckets && registry_grow(reg) != OK) {
+		return ENOMEM;
+	}
+
+	if (reg->count >= reg->ids_cap && registry_grow_ids(reg) != OK) {
+		return ENOMEM;
+	}
+
+	l->hash = hash_name(l->logger.name);
+	l->tail = NULL;
+
+	unsigned int b = l->hash & (reg->nbuckets - 1);
+	l->hash_next = reg->buckets[b];
+	reg->buckets[b] = l;
+
+	if (reg->last) {
+		reg->last->tail = l;
+	} else {
+		reg->head = l;
+	}
+	reg->last = l;
+
+	l->id = reg->count;
+	reg->by_id[reg->count++] = l;
+
+	return OK;
+}
+
+void registry_free(ls_registry_t* reg) {
+	ls_logger_list_t* nxt;
+	for (ls_logger_list_t* l = reg->head; l; l = nxt) {
+		nxt = l->tail;
+		free(l->spec);
+		free(l);
+	}
+
+	free(reg->buckets);
+	free(reg->by_id);
+	registry_init(reg);
+}
@@ -6,6 +6,7 @@
 #include "config-parse.h"
 #include <minix/safecopies.h>
 #include <minix/syslib.h>
+#include <minix/minlib.h>
 #include <string.h>
 
 #include "../pm/mproc.h"
@@ -16,6 +17,23 @@ struct mproc proctable[NR_PROCS];
 #define LOGBUF_LEN				4096
 char g_logbuf[LOGBUF_LEN];
 
+/* Messages are copied in here from the client before being formatted. Only
+ * one request is ever served at a time, so all loggers can share it. */
+char g_msgbuf[LS_MAX_MESSAGE_LEN];
+
+/* Arguments of a minix_ls_writef line, which are rendered into g_msgbuf. */
+char g_argbuf[LS_MAX_MESSAGE_LEN];
+
+/* Lines of an LS_WRITE_BATCH. */
+char g_batchbuf[MINIX_LS_MAX_BATCH_LEN];
+
+/* Number of loggers created through do_create_logger since the config was
+ * last parsed. */
+int g_dynamic_loggers;
+
+/* Open loggers that have suppressed lines not yet reported. */
+int g_suppressing;
+
 #define TRY_ENSURE_INITIALIZED() \
 	do { \
 		int ret = ensure_initialized(); \
@@ -57,16 +75,34 @@ int procname_from_pid(endpoint_t pid, char* buffer, int buffer_len) {
 }
 
 int do_initialize() {
-	if (g_loggers) {
-		ls_logger_list_t* nxt;
-		for (ls_logger_list_t* l = g_loggers; l; l = nxt) {
-			nxt = l->tail;
-			free(l);
+	/* Open loggers are closed, so that their files are not left open with the
+	 * settings of sinks that are about to be freed. Queued lines point into
+	 * the loggers too. */
+	for (ls_logger_list_t* l = g_config.loggers.head; l; l = l->tail) {
+		if (l->state.is_open) {
+			dedup_flush(l, l->state.opened_by);
+			flush_suppressed(l, l->state.opened_by);
 		}
 	}
-	g_loggers = NULL;
+	queue_drain(-1);
+	for (ls_logger_list_t* l = g_config.loggers.head; l; l = l->tail) {
+		if (l->state.is_open) {
+			close_sinks(l);
+		}
+	}
+	subscribers_clear();
+	config_free(&g_config);
+	g_config_generation++;
+	g_dynamic_loggers = 0;
+	g_suppressing = 0;
+	ratelimit_init();
+
+	int ret = clock_init();
+	if (ret != OK) {
+		return ret;
+	}
 
-	int ret = parse_config_file("/etc/logs.conf", &g_loggers);
+	ret = parse_config_file("/etc/logs.conf", &g_config);
 	if (ret != OK) {
 		return ret;
 	}
@@ -74,7 +110,67 @@ int do_initialize() {
 	return get_process_table();
 }
 
-int do_start_log(const char* logger, endpoint_t who) {
+/* Opens the files of the logger's sinks. A logger that is being reopened
+ * after a restart of ls is always appended to. */
+int open_sinks(ls_logger_list_t* l, int reopen) {
+	for (int i = 0; i < l->logger.nsinks; i++) {
+		ls_sink_t* sink = &l->logger.sinks[i];
+
+		l->state.file[i] = NULL;
+		if (sink->dest_type != LS_DESTINATION_FILE) {
+			continue;
+		}
+
+		l->state.file[i] = file_open(sink, !sink->append && !reopen);
+		if (!l->state.file[i]) {
+			LS_LOG_PRINTF(warn, "Failed to open file '%s' for writing to logger '%s'", sink->dest_filename, l->logger.name);
+			while (--i >= 0) {
+				if (l->state.file[i]) {
+					file_close(l->state.file[i]);
+				}
+			}
+			return LS_ERR_EXTERNAL;
+		}
+		file_counts(l->state.file[i], &l->state.file_writes[i], &l->state.file_syncs[i]);
+	}
+
+	return OK;
+}
+
+/* Adds the writes and syncs done on the logger's files since they were last
+ * counted to the logger's counters. A file shared with other loggers counts
+ * for each of them. */
+void count_sinks(ls_logger_list_t* l) {
+	for (int i = 0; i < l->logger.nsinks; i++) {
+		unsigned int writes, syncs;
+
+		if (!l->state.file[i]) {
+			continue;
+		}
+
+		file_counts(l->state.file[i], &writes, &syncs);
+		l->state.stats.writes += writes - l->state.file_writes[i];
+		l->state.stats.syncs += syncs - l->state.file_syncs[i];
+		l->state.file_writes[i] = writes;
+		l->state.file_syncs[i] = syncs;
+	}
+}
+
+void close_sinks(ls_logger_list_t* l) {
+	count_sinks(l);
+	for (int i = 0; i < l->logger.nsinks; i++) {
+		if (l->state.file[i]) {
+			if (file_close(l->state.file[i]) != OK) {
+				LS_LOG_PRINTF(warn, "Failed to close file '%s' for logger '%s'", l->logger.sinks[i].dest_filename, l->logger.name);
+			}
+		}
+
+		l->state.file[i] = NULL;
+	}
+}
+
+int do_start_log(const char* logger, endpoint_t who, mess_ls_start_log_reply* reply) {
+	int ret;
 	LS_LOG_PRINTF(info, "Starting logger '%s' by pid %d", logger, who);
 
 	ls_logger_list_t* l;
@@ -86,34 +182,34 @@ int do_start_log(const char* logger, endpoint_t who) {
 		return LS_ERR_LOGGER_OPEN;
 	}
 
-	if (l->logger.dest_type == LS_DESTINATION_FILE) {
-		int flags = O_WRONLY | O_CREAT;
-		if (l->logger.append) {
-			flags |= O_APPEND;
-		} else {
-			flags |= O_TRUNC;
-		}
-
-		int fd = open(l->logger.dest_filename, flags);
-		if (fd < 0) {
-			LS_LOG_PRINTF(warn, "Failed to open file '%s' for writing to logger '%s'", l->logger.dest_filename, logger);
-			return LS_ERR_EXTERNAL;
-		}
-
-		l->state.fd = fd;
+	if ((ret = open_sinks(l, FALSE)) != OK) {
+		return ret;
 	}
 
 	l->state.severity = l->logger.severity;
+	l->state.suppressed = 0;
+	l->state.repeats = 0;
+	l->state.dedup_valid = FALSE;
+	l->state.overflowing = FALSE;
+	l->state.is_blocked = FALSE;
+	bucket_init(&l->state.bucket, l->logger.rate, l->logger.burst);
 	l->state.is_open = TRUE;
 	l->state.opened_by = who;
 	LS_LOG_PRINTF(info, "Opened logger '%s' with severity %s", logger, severity_to_str(l->state.severity));
 
+	reply->handle = make_handle(l);
+	reply->severity = (uint16_t)l->state.severity;
+	for (int i = 0; i < LS_NUM_SEVERITIES; i++) {
+		reply->sample_every[i] = (uint16_t)l->logger.sample_every[i];
+	}
+	reply->tsc_khz = clock_tsc_khz();
+
 	// Need to update the process table since we've got a new process on the
 	// block.
 	return get_process_table();
 }
 
-int do_close_log(const char* logger, endpoint_t who) {
+int do_close_log(const char* logger, unsigned int filtered, unsigned int sampled, endpoint_t who) {
 	LS_LOG_PRINTF(info, "Closing logger '%s' by pid %d", logger, who);
 
 	ls_logger_list_t* l;
@@ -130,74 +226,412 @@ int do_close_log(const char* logger, endpoint_t who) {
 		return LS_ERR_PERMISSION_DENIED;
 	}
 
-	if (l->logger.dest_type == LS_DESTINATION_FILE) {
-		int ret;
-		if ((ret = close(l->state.fd)) != OK) {
-			LS_LOG_PRINTF(warn, "Failed to close file for logger '%s'", logger);
-			goto set_closed;
-			return LS_ERR_EXTERNAL;
-		}
-	}
+	l->state.stats.filtered += filtered;
+	l->state.stats.sampled += sampled;
+
+	dedup_flush(l, who);
+	flush_suppressed(l, who);
+	queue_drain(-1);
+	close_sinks(l);
 
-set_closed:
 	l->state.is_open = FALSE;
 	l->state.opened_by = -1;
-	l->state.fd = -1;
 
 	return OK;
 }
 
-int do_write_log(const char* logger, ls_severity_level_t severity, char* msg, int msg_len, endpoint_t who) {
+/* Writes an already formatted line to the given sinks of the logger. Only
+ * the first copy of a line (there is one per distinct format) counts towards
+ * the written lines. tsc is the time of the line, for file indexes. */
+int write_line(ls_logger_list_t* l, ls_severity_level_t severity, unsigned int sinks, int first, u64_t tsc, char* buf, int sz) {
+	int result = OK;
+
+	for (int i = 0; i < l->logger.nsinks; i++) {
+		ls_sink_t* sink = &l->logger.sinks[i];
+		if (!(sinks & (1u << i))) {
+			continue;
+		}
+
+		if (sink->dest_type == LS_DESTINATION_FILE) {
+			file_index_line(l->state.file[i], severity, tsc);
+			if (file_write(l->state.file[i], buf, sz) != OK) {
+				LS_LOG_PRINTF(warn, "Failed writing log line to file '%s' for logger '%s'", sink->dest_filename, l->logger.name);
+				result = LS_ERR_EXTERNAL;
+			}
+		} else if (sink->dest_type == LS_DESTINATION_SYSLOG) {
+			if (syslog_append(sink->facility, severity, buf, sz) != OK) {
+				result = LS_ERR_EXTERNAL;
+			}
+		} else {
+			console_write(sink->dest_type, buf, sz);
+		}
+	}
+
+	if (first && result == OK) {
+		l->state.stats.written++;
+	}
+
+	return result;
+}
+
+/* Formats the line once for every distinct format among the sinks that take
+ * its severity, and queues each rendering for all the sinks sharing it. tsc is
+ * the time of the event as stamped by the client, or 0 to stamp it now. */
+int emit_line(ls_logger_list_t* l, ls_severity_level_t severity, const char* msg, int msg_len, u64_t tsc, endpoint_t who) {
+	const ls_sink_t* sinks = l->logger.sinks;
+	unsigned int done = 0;
+	int first = TRUE;
 	int ret;
-	LS_LOG_PRINTF(debug, "Writing to logger '%s' from pid %d", logger, who);
 
-	ls_logger_list_t* l;
-	TRY_ENSURE_INITIALIZED();
-	TRY_FIND_LOGGER(logger, l);
+	char procname[256];
+	if (!procname_from_pid(who, procname, 256)) {
+		strncpy(procname, "unknown-pid", 256);
+	}
 
+	/* Lines written with minix_ls_write_kv carry their fields after a NUL. */
+	int text_len = strnlen(msg, msg_len);
+
+	ls_line_info_t info;
+	info.fields = text_len < msg_len ? msg + text_len + 1 : NULL;
+	info.fields_len = text_len < msg_len ? msg_len - text_len - 1 : 0;
+	info.severity = severity;
+	info.procname = procname;
+	info.seq = l->state.seq++;
+	info.tsc = tsc;
+	if (!info.tsc) {
+		read_tsc_64(&info.tsc);
+	}
+
+	for (int i = 0; i < l->logger.nsinks; i++) {
+		if ((done & (1u << i)) || severity < sinks[i].severity) {
+			continue;
+		}
+
+		unsigned int mask = 0;
+		for (int j = i; j < l->logger.nsinks; j++) {
+			if (!(done & (1u << j)) && severity >= sinks[j].severity &&
+					strcmp(sinks[j].format, sinks[i].format) == 0) {
+				mask |= 1u << j;
+			}
+		}
+		done |= mask;
+
+		int sz = print_log(sinks[i].format, msg, text_len, &info, g_logbuf, LOGBUF_LEN - 1);
+		g_logbuf[LOGBUF_LEN - 1] = '\0';
+
+		if (first) {
+			subscribers_publish(l, severity, g_logbuf, sz);
+		}
+
+		if ((ret = queue_line(l, severity, mask, first, info.tsc, g_logbuf, sz)) != OK) {
+			return ret;
+		}
+		first = FALSE;
+	}
+
+	return OK;
+}
+
+/* Writes the "N messages suppressed" summary for lines dropped by the rate
+ * limiter since the last line that got through. */
+int flush_suppressed(ls_logger_list_t* l, endpoint_t who) {
+	char msg[64];
+
+	if (!l->state.suppressed) {
+		return OK;
+	}
+
+	mini_snprintf(msg, sizeof(msg), "%u messages suppressed by rate limiting", l->state.suppressed);
+	msg[sizeof(msg) - 1] = '\0';
+	l->state.suppressed = 0;
+	g_suppressing--;
+
+	return emit_line(l, LS_SEV_WARN, msg, strlen(msg), 0, who);
+}
+
+/* Called on every tick of the drain timer. Writes the summary of loggers whose
+ * lines were suppressed as soon as their buckets have refilled, so that it
+ * does not wait for the next line, which may never come. */
+void suppressed_alarm() {
+	if (g_suppressing == 0) {
+		return;
+	}
+
+	for (ls_logger_list_t* l = g_config.loggers.head; l; l = l->tail) {
+		if (l->state.is_open && l->state.suppressed && ratelimit_ready(l, l->state.opened_by)) {
+			flush_suppressed(l, l->state.opened_by);
+		}
+	}
+}
+
+/* Returns TRUE if a logger has suppressed lines it has not reported yet. */
+int suppressed_pending() {
+	return g_suppressing > 0;
+}
+
+int check_writer(ls_logger_list_t* l, endpoint_t who) {
 	if (!l->state.is_open) {
-		LS_LOG_PRINTF(warn, "Logger not open: '%s'", logger);
+		LS_LOG_PRINTF(warn, "Logger not open: '%s'", l->logger.name);
 		return LS_ERR_LOGGER_NOT_OPEN;
 	}
 
 	if (l->state.opened_by != who) {
-		LS_LOG_PRINTF(warn, "Process %d tried to log through logger '%s', but it is not the owner", who, logger);
+		LS_LOG_PRINTF(warn, "Process %d tried to log through logger '%s', but it is not the owner", who, l->logger.name);
 		return LS_ERR_PERMISSION_DENIED;
 	}
 
-	if ((ret = sys_vircopy(who, (vir_bytes) msg, LS_PROC_NR, (vir_bytes) l->state.msg_buf, msg_len, 0)) != OK) {
+	return OK;
+}
+
+/* Copies len bytes from a client, through the grant if it has given one. */
+int copy_from_client(endpoint_t who, vir_bytes src, cp_grant_id_t grant, void* dest, int len) {
+	int ret;
+
+	if (grant != GRANT_INVALID) {
+		ret = sys_safecopyfrom(who, grant, 0, (vir_bytes) dest, len);
+	} else {
+		ret = sys_vircopy(who, src, LS_PROC_NR, (vir_bytes) dest, len, 0);
+	}
+
+	if (ret != OK) {
 		LS_LOG_PRINTF(warn, "Copying from user address space failed: %d", ret);
+	}
+
+	return ret;
+}
+
+/* Copies the message of a line into g_msgbuf. For a minix_ls_writef line, the
+ * arguments are copied instead and the message is rendered from them, and
+ * msg_len is updated to the length of the result. */
+int copy_message(const ls_write_t* w, int* msg_len, endpoint_t who) {
+	char* dest = w->format_id ? g_argbuf : g_msgbuf;
+	int ret;
+
+	if (w->local) {
+		memcpy(dest, w->msg, *msg_len);
+	} else if ((ret = copy_from_client(who, (vir_bytes) w->msg, w->grant, dest, *msg_len)) != OK) {
 		return ret;
 	}
 
+	if (w->format_id) {
+		if ((ret = format_render(w->format_id, g_argbuf, *msg_len, g_msgbuf, LS_MAX_MESSAGE_LEN)) < 0) {
+			return ret;
+		}
+		*msg_len = ret;
+	}
+
+	return OK;
+}
+
+/* Runs a line through filtering, sampling (unless the client already did
+ * that), dedup and rate limiting, and writes it out if it survives. */
+int accept_line(ls_logger_list_t* l, const ls_write_t* w, int sample, endpoint_t who) {
+	ls_severity_level_t severity = w->severity;
+	int msg_len = w->msg_len;
+	int ret;
+
 	if (severity < l->state.severity) {
-		LS_LOG_PRINTF(debug, "Ignored message for logger '%s' due to its severity (%s)", logger, severity_to_str(severity));
+		LS_LOG_PRINTF(debug, "Ignored message for logger '%s' due to its severity (%s)", l->logger.name, severity_to_str(severity));
+		l->state.stats.filtered++;
 		return OK;
 	}
 
-	char procname[256];
-	if (!procname_from_pid(who, procname, 256)) {
-		strncpy(procname, "unknown-pid", 256);
+	if (sample && !sample_keep(l, severity)) {
+		l->state.stats.sampled++;
+		return OK;
 	}
 
-	int sz = print_log(l->logger.format, l->state.msg_buf, msg_len, severity, procname, g_logbuf, LOGBUF_LEN - 1);
-	g_logbuf[LOGBUF_LEN - 1] = '\0';
+	int copied = FALSE;
+	u64_t hash = 0;
+	if (l->logger.dedup) {
+		if ((ret = copy_message(w, &msg_len, who)) != OK) {
+			return ret;
+		}
+		copied = TRUE;
+
+		hash = hash_message(severity, g_msgbuf, msg_len);
+		if (dedup_is_repeat(l, hash, msg_len)) {
+			l->state.repeats++;
+			l->state.stats.folded++;
+			if (l->state.repeats >= LS_DEDUP_FLUSH_REPEATS) {
+				return dedup_flush(l, who);
+			}
 
-	if (l->logger.dest_type == LS_DESTINATION_FILE) {
-		int ret = write(l->state.fd, g_logbuf, sz);
-		LS_LOG_PRINTF(debug, "Message buffer size is %d, %d written, fd %d", sz, ret, l->state.fd);
+			return OK;
+		}
+	}
 
-		if (ret == -1 || ret < sz) {
-			LS_LOG_PRINTF(warn, "Failed writing log line to file '%s' for logger '%s'", l->logger.dest_filename, logger);
-			return LS_ERR_EXTERNAL;
+	if (!ratelimit_allow(l, who)) {
+		if (l->state.suppressed++ == 0) {
+			g_suppressing++;
 		}
+		l->state.stats.suppressed++;
+		return OK;
+	}
 
-		fsync(l->state.fd);
-	} else {
-		g_logbuf[sz] = 0;
-		printf("[L] %s", g_logbuf);
+	if (!copied && (ret = copy_message(w, &msg_len, who)) != OK) {
+		return ret;
 	}
 
+	if ((ret = dedup_flush(l, who)) != OK || (ret = flush_suppressed(l, who)) != OK) {
+		return ret;
+	}
+
+	if ((ret = emit_line(l, severity, g_msgbuf, msg_len, w->tsc, who)) != OK) {
+		return ret;
+	}
+
+	if (l->logger.dedup) {
+		dedup_remember(l, hash, msg_len, severity);
+	}
+
+	return OK;
+}
+
+int do_write_log(const char* logger, const ls_write_t* w, endpoint_t who) {
+	int ret;
+	LS_LOG_PRINTF(debug, "Writing to logger '%s' from pid %d", logger, who);
+
+	ls_logger_list_t* l;
+	TRY_ENSURE_INITIALIZED();
+	TRY_FIND_LOGGER(logger, l);
+
+	if ((ret = check_writer(l, who)) != OK) {
+		return ret;
+	}
+
+	if ((ret = accept_line(l, w, TRUE, who)) == OK && queue_block(l, who)) {
+		return EDONTREPLY;
+	}
+
+	return ret;
+}
+
+/* Looks up the logger behind a handle for a write, and takes over the
+ * counters of lines the client has thrown away since its last write. */
+ls_logger_list_t* writer_by_handle(int handle, unsigned int filtered, unsigned int sampled, endpoint_t who, int* ret) {
+	ls_logger_list_t* l = find_logger_by_handle(handle);
+	if (!l) {
+		LS_LOG_PRINTF(warn, "Invalid logger handle %d from pid %d", handle, who);
+		*ret = LS_ERR_NO_SUCH_LOGGER;
+		return NULL;
+	}
+
+	if ((*ret = check_writer(l, who)) != OK) {
+		return NULL;
+	}
+
+	l->state.stats.filtered += filtered;
+	l->state.stats.sampled += sampled;
+
+	return l;
+}
+
+int do_write(int handle, const ls_write_t* w, unsigned int filtered, unsigned int sampled, endpoint_t who) {
+	int ret;
+
+	TRY_ENSURE_INITIALIZED();
+
+	ls_logger_list_t* l = writer_by_handle(handle, filtered, sampled, who, &ret);
+	if (!l) {
+		return ret;
+	}
+
+	if ((ret = accept_line(l, w, FALSE, who)) == OK && queue_block(l, who)) {
+		return EDONTREPLY;
+	}
+
+	return ret;
+}
+
+/* Writes a batch of lines buffered by the client, as laid out by
+ * ls_batch_line_t. The whole batch is copied in one go. A line that cannot be
+ * written does not stop the rest; the first error is returned. Nothing of the
+ * batch is taken if it has a format id that ls does not know. */
+int do_write_batch(int handle, vir_bytes batch, cp_grant_id_t grant, int batch_len, unsigned int filtered, unsigned int sampled, endpoint_t who) {
+	int result = OK;
+	int ret;
+
+	TRY_ENSURE_INITIALIZED();
+
+	if ((ret = copy_from_client(who, batch, grant, g_batchbuf, batch_len)) != OK) {
+		return ret;
+	}
+
+	/* A batch with a format ls does not know, e.g. because it lost its formats
+	 * in a restart, is refused as a whole, so that the client can render the
+	 * lines itself and send them all again without any being logged twice. */
+	for (int pos = 0; batch_len - pos >= (int) sizeof(ls_batch_line_t); ) {
+		ls_batch_line_t line;
+
+		memcpy(&line, g_batchbuf + pos, sizeof(line));
+		if (line.format_id && !format_text(line.format_id)) {
+			LS_LOG_PRINTF(warn, "Unknown format id %d in a batch from pid %d", line.format_id, who);
+			return LS_ERR_NO_SUCH_FORMAT;
+		}
+		pos += sizeof(line) + LS_BATCH_ALIGN(line.message_len);
+	}
+
+	ls_logger_list_t* l = writer_by_handle(handle, filtered, sampled, who, &ret);
+	if (!l) {
+		return ret;
+	}
+
+	int pos = 0;
+	while (batch_len - pos >= (int) sizeof(ls_batch_line_t)) {
+		ls_batch_line_t line;
+		ls_write_t w;
+
+		memcpy(&line, g_batchbuf + pos, sizeof(line));
+		pos += sizeof(line);
+
+		if (line.message_len > LS_MAX_MESSAGE_LEN || line.message_len > batch_len - pos || !valid_severity(line.severity)) {
+			LS_LOG_PRINTF(warn, "Malformed batch for logger '%s' from pid %d", l->logger.name, who);
+			result = EINVAL;
+			break;
+		}
+
+		w.severity = line.severity;
+		w.msg = g_batchbuf + pos;
+		w.grant = GRANT_INVALID;
+		w.msg_len = line.message_len;
+		w.format_id = line.format_id;
+		w.tsc = line.tsc;
+		w.local = TRUE;
+
+		if ((ret = accept_line(l, &w, FALSE, who)) != OK && result == OK) {
+			result = ret;
+		}
+
+		pos += LS_BATCH_ALIGN(line.message_len);
+	}
+
+	if (result == OK && queue_block(l, who)) {
+		return EDONTREPLY;
+	}
+
+	return result;
+}
+
+int do_register_format(vir_bytes format, int format_len, endpoint_t who, mess_ls_register_format_reply* reply) {
+	char text[LS_MAX_WRITEF_FORMAT_LEN];
+	int ret;
+
+	if ((ret = sys_vircopy(who, format, LS_PROC_NR, (vir_bytes) text, format_len, 0)) != OK) {
+		LS_LOG_PRINTF(warn, "Copying from user address space failed: %d", ret);
+		return ret;
+	}
+	text[format_len] = '\0';
+
+	if ((int) strlen(text) != format_len) {
+		return EINVAL;
+	}
+
+	if ((ret = format_register(text, who)) < 0) {
+		return ret;
+	}
+
+	reply->format_id = ret;
 	return OK;
 }
 
@@ -222,7 +656,7 @@ int do_clear_logs() {
 	TRY_ENSURE_INITIALIZED();
 
 	int ret = OK;
-	for (ls_logger_list_t* l = g_loggers; l; l = l->tail) {
+	for (ls_logger_list_t* l = g_config.loggers.head; l; l = l->tail) {
 		if (do_clear_log(l->logger.name) != OK) {
 			ret = LS_ERR_LOGGER_OPEN;
 		}
@@ -242,16 +676,21 @@ int do_clear_log(const char* logger) {
 		LS_LOG_PRINTF(warn, "Cannot clear log for '%s' as it is open", l->logger.name);
 		return LS_ERR_LOGGER_OPEN;
 	} else {
-		if (l->logger.dest_type == LS_DESTINATION_FILE) {
-			int fd = open(l->logger.dest_filename, O_WRONLY | O_TRUNC | O_CREAT);
+		for (int i = 0; i < l->logger.nsinks; i++) {
+			ls_sink_t* sink = &l->logger.sinks[i];
+			if (sink->dest_type != LS_DESTINATION_FILE) {
+				continue;
+			}
+
+			int fd = open(sink->dest_filename, O_WRONLY | O_TRUNC | O_CREAT);
 			if (fd < 0) {
-				LS_LOG_PRINTF(warn, "Failed to open file '%s' for truncation of logger '%s'", l->logger.dest_filename, logger);
+				LS_LOG_PRINTF(warn, "Failed to open file '%s' for truncation of logger '%s'", sink->dest_filename, logger);
 				return LS_ERR_EXTERNAL;
 			}
 
 			int ret = close(fd);
 			if (ret != OK) {
-				LS_LOG_PRINTF(warn, "Failed to close file for truncation '%s' for logger '%s'", l->logger.dest_filename, logger);
+				LS_LOG_PRINTF(warn, "Failed to close file for truncation '%s' for logger '%s'", sink->dest_filename, logger);
 				return LS_ERR_EXTERNAL;
 			}
 		}
@@ -259,3 +698,98 @@ int do_clear_log(const char* logger) {
 
 	return OK;
 }
+
+int do_create_logger(const char* logger, vir_bytes spec, int template_len, int overrides_len, endpoint_t who) {
+	int ret;
+	LS_LOG_PRINTF(info, "Creating logger '%s' for pid %d", logger, who);
+
+	TRY_ENSURE_INITIALIZED();
+
+	if (template_len <= 0 || template_len > LS_MAX_LOGGER_NAME_LEN - 1 ||
+			overrides_len < 0 || overrides_len > LS_MAX_OVERRIDES_LEN) {
+		return EINVAL;
+	}
+
+	if (logger[0] == '\0' || strlen(logger) > LS_MAX_LOGGER_NAME_LEN - 1) {
+		return EINVAL;
+	}
+
+	if (find_logger(logger)) {
+		LS_LOG_PRINTF(warn, "Logger '%s' already exists", logger);
+		return LS_ERR_LOGGER_EXISTS;
+	}
+
+	if (g_dynamic_loggers >= g_config.settings.max_dynamic_loggers) {
+		LS_LOG_PRINTF(warn, "Cannot create logger '%s', limit of %d dynamic loggers reached", logger, g_config.settings.max_dynamic_loggers);
+		return LS_ERR_LIMIT_REACHED;
+	}
+
+	/* The spec is the template name immediately followed by the overrides. */
+	if ((ret = sys_vircopy(who, spec, LS_PROC_NR, (vir_bytes) g_msgbuf, template_len + overrides_len, 0)) != OK) {
+		LS_LOG_PRINTF(warn, "Copying from user address space failed: %d", ret);
+		return ret;
+	}
+
+	return create_logger(logger, g_msgbuf, template_len, overrides_len);
+}
+
+/* Makes a logger from a template, as asked for by do_create_logger, or again
+ * after a restart. */
+int create_logger(const char* logger, const char* spec, int template_len, int overrides_len) {
+	int ret;
+
+	char template_name[LS_MAX_LOGGER_NAME_LEN];
+	memcpy(template_name, spec, template_len);
+	template_name[template_len] = '\0';
+
+	ls_logger_list_t* tmpl = registry_find(&g_config.templates, template_name);
+	if (!tmpl) {
+		LS_LOG_PRINTF(warn, "Template not found: '%s'", template_name);
+		return LS_ERR_NO_SUCH_TEMPLATE;
+	}
+
+	ls_logger_t new_logger;
+	if ((ret = instantiate_template(&tmpl->logger, logger, spec + template_len, overrides_len, &new_logger)) != OK) {
+		return ret;
+	}
+
+	char* spec_copy = malloc(template_len + overrides_len);
+	if (!spec_copy) {
+		return ENOMEM;
+	}
+	memcpy(spec_copy, spec, template_len + overrides_len);
+
+	if ((ret = add_logger(&g_config.loggers, &new_logger)) != OK) {
+		free(spec_copy);
+		return ret;
+	}
+
+	ls_logger_list_t* l = g_config.loggers.last;
+	l->spec = spec_copy;
+	l->template_len = template_len;
+	l->overrides_len = overrides_len;
+
+	g_dynamic_loggers++;
+	LS_LOG_PRINTF(info, "Created logger '%s' from template '%s'", logger, template_name);
+
+	return OK;
+}
+
+int do_get_stats(const char* logger, vir_bytes stats, endpoint_t who) {
+	int ret;
+
+	ls_logger_list_t* l;
+	TRY_ENSURE_INITIALIZED();
+	TRY_FIND_LOGGER(logger, l);
+
+	if (l->state.is_open) {
+		count_sinks(l);
+	}
+
+	if ((ret = sys_vircopy(LS_PROC_NR, (vir_bytes) &l->state.stats, who, stats, sizeof(minix_ls_stats_t), 0)) != OK) {
+		LS_LOG_PRINTF(warn, "Copying to user address space failed: %d", ret);
+		return ret;
+	}
+
+	return OK;
+}
@@ -0,0 +1,25 @@
+#include "proto.h"
+
+/* Probabilistic sampling of lines per severity. A logger with
+ * `sample.<level> = 1/N` keeps each line of that level with probability 1/N.
+ * Clients using the libc wrappers get the sampling rates when they start the
+ * logger and drop lines themselves, before any IPC; ls only samples lines that
+ * are written by logger name, and otherwise just accounts for what the client
+ * reports. */
+
+u32_t g_sample_state = 2463534242u;
+
+u32_t sample_next() {
+	/* xorshift32 */
+	u32_t x = g_sample_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return g_sample_state = x;
+}
+
+int sample_keep(const ls_logger_list_t* l, ls_severity_level_t severity) {
+	int every = l->logger.sample_every[severity];
+	return every <= 1 || sample_next() % (u32_t)every == 0;
+}
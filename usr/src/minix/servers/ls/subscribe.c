@@ -0,0 +1,306 @@
+#include "inc.h"
+#include "mini-printf.h"
+
+/* Processes following a logger through minix_ls_subscribe. Every line that
+ * the logger accepts at or above the subscriber's level is added to a buffer
+ * kept for the subscriber as soon as it is accepted, formatted as for the
+ * first of the logger's destinations that takes it, so subscribers never
+ * wait for lines to be written out. The subscriber takes whatever has piled up with one read, which
+ * is a single copy into its buffer; a read that finds nothing is not replied
+ * to until there is something. A subscriber that falls behind loses its
+ * oldest records, and learns how many with its next read.
+ *
+ * Subscriptions refer to loggers, so they are dropped whenever the config is
+ * read again, and they are not kept across a restart of ls either. Reading or
+ * ending a dropped subscription fails with LS_ERR_NO_SUCH_SUBSCRIPTION, and a
+ * read that was waiting is replied to with that error.
+ *
+ * ls is not told when a subscriber exits, so a subscription remembers the pid
+ * its endpoint had, and is dropped once the endpoint no longer has that pid:
+ * when a reply to a waiting read cannot be sent, when the subscriber's buffer
+ * is full, before a new subscription is added, and when the endpoint uses
+ * the subscription, in case the endpoint now belongs to another process. A
+ * process can subscribe to a logger only once, and to at most
+ * LS_MAX_SUBSCRIPTIONS_PER_CLIENT loggers. */
+
+typedef struct ls_subscriber_t {
+	endpoint_t who;
+	pid_t pid;
+	ls_logger_list_t* logger;
+	ls_severity_level_t severity;
+	unsigned int dropped;
+	int waiting;
+	vir_bytes wait_buf;
+	cp_grant_id_t wait_grant;
+	int wait_len;
+	int start;
+	int len;
+	char buf[LS_SUBSCRIBER_BUFSIZE];
+} ls_subscriber_t;
+
+ls_subscriber_t* g_subscribers[LS_MAX_SUBSCRIBERS];
+int g_nsubscribers;
+
+int copy_to_client(endpoint_t who, vir_bytes dest, cp_grant_id_t grant, const void* src, int len) {
+	int ret;
+
+	if (grant != GRANT_INVALID) {
+		ret = sys_safecopyto(who, grant, 0, (vir_bytes) src, len);
+	} else {
+		ret = sys_vircopy(LS_PROC_NR, (vir_bytes) src, who, dest, len, 0);
+	}
+
+	if (ret != OK) {
+		LS_LOG_PRINTF(warn, "Copying to user address space failed: %d", ret);
+	}
+
+	return ret;
+}
+
+/* Returns TRUE if the subscriber's endpoint still belongs to the process
+ * that subscribed. */
+int subscriber_alive(const ls_subscriber_t* s) {
+	return getnpid(s->who) == s->pid;
+}
+
+void subscriber_free(int id);
+
+ls_subscriber_t* find_subscriber(int id, endpoint_t who) {
+	if (id < 0 || id >= LS_MAX_SUBSCRIBERS || !g_subscribers[id] || g_subscribers[id]->who != who) {
+		return NULL;
+	}
+
+	if (!subscriber_alive(g_subscribers[id])) {
+		subscriber_free(id);
+		return NULL;
+	}
+
+	return g_subscribers[id];
+}
+
+int record_size(const ls_subscriber_t* s, int pos) {
+	minix_ls_record_t rec;
+
+	memcpy(&rec, s->buf + pos, sizeof(rec));
+	return MINIX_LS_RECORD_SIZE(rec.len);
+}
+
+/* Copies as many whole records as fit into the subscriber's buffer. */
+int subscriber_read(ls_subscriber_t* s, vir_bytes buf, cp_grant_id_t grant, int buf_len, mess_ls_read_subscription_reply* reply) {
+	int n = 0;
+	int ret;
+
+	while (n < s->len && n + record_size(s, s->start + n) <= buf_len) {
+		n += record_size(s, s->start + n);
+	}
+
+	if (n == 0) {
+		return EINVAL;
+	}
+
+	if ((ret = copy_to_client(s->who, buf, grant, s->buf + s->start, n)) != OK) {
+		return ret;
+	}
+
+	reply->len = n;
+	reply->dropped = s->dropped;
+	s->dropped = 0;
+	s->start += n;
+	s->len -= n;
+	if (s->len == 0) {
+		s->start = 0;
+	}
+
+	return OK;
+}
+
+/* Replies to a waiting read. Fails if the subscriber cannot be replied to,
+ * e.g. because it has exited. */
+int subscriber_wake(ls_subscriber_t* s, int result) {
+	message m;
+	int ret;
+
+	memset(&m, 0, sizeof(m));
+	if (result == OK) {
+		result = subscriber_read(s, s->wait_buf, s->wait_grant, s->wait_len, &m.m_ls_read_subscription_reply);
+	}
+
+	s->waiting = FALSE;
+	m.m_type = result;
+	if ((ret = ipc_send(s->who, &m)) != OK) {
+		LS_LOG_PRINTF(info, "Subscriber %d is gone, dropping its subscription: %d", s->who, ret);
+	}
+
+	return ret;
+}
+
+/* Makes room for a record by dropping the oldest ones, a quarter of the
+ * buffer at a time, so that a subscriber which has fallen behind does not
+ * move its whole buffer around for every new record. */
+void subscriber_append(ls_subscriber_t* s, ls_severity_level_t severity, const char* line, int len) {
+	minix_ls_record_t rec;
+	int size = MINIX_LS_RECORD_SIZE(len);
+
+	if (s->len + size > LS_SUBSCRIBER_BUFSIZE) {
+		while (s->len > 0 && s->len + size > LS_SUBSCRIBER_BUFSIZE * 3 / 4) {
+			int dropped = record_size(s, s->start);
+			s->start += dropped;
+			s->len -= dropped;
+			s->dropped++;
+		}
+	}
+
+	if (s->start + s->len + size > LS_SUBSCRIBER_BUFSIZE) {
+		memmove(s->buf, s->buf + s->start, s->len);
+		s->start = 0;
+	}
+
+	rec.severity = severity;
+	rec.len = len;
+	memcpy(s->buf + s->start + s->len, &rec, sizeof(rec));
+	memcpy(s->buf + s->start + s->len + sizeof(rec), line, len);
+	s->len += size;
+}
+
+/* Called with every line a logger accepts. */
+void subscribers_publish(ls_logger_list_t* l, ls_severity_level_t severity, const char* line, int len) {
+	if (g_nsubscribers == 0 || len > MINIX_LS_MAX_LINE_LEN) {
+		return;
+	}
+
+	for (int i = 0; i < LS_MAX_SUBSCRIBERS; i++) {
+		ls_subscriber_t* s = g_subscribers[i];
+		if (!s || s->logger != l || severity < s->severity) {
+			continue;
+		}
+
+		/* A full buffer may be one nobody reads any more. */
+		if (s->len + MINIX_LS_RECORD_SIZE(len) > LS_SUBSCRIBER_BUFSIZE && !subscriber_alive(s)) {
+			subscriber_free(i);
+			continue;
+		}
+
+		subscriber_append(s, severity, line, len);
+		if (s->waiting && subscriber_wake(s, OK) != OK) {
+			subscriber_free(i);
+		}
+	}
+}
+
+void subscriber_free(int id) {
+	ls_subscriber_t* s = g_subscribers[id];
+
+	if (s->waiting) {
+		subscriber_wake(s, LS_ERR_NO_SUCH_SUBSCRIPTION);
+	}
+
+	free(s);
+	g_subscribers[id] = NULL;
+	g_nsubscribers--;
+}
+
+void subscribers_clear() {
+	for (int i = 0; i < LS_MAX_SUBSCRIBERS; i++) {
+		if (g_subscribers[i]) {
+			subscriber_free(i);
+		}
+	}
+}
+
+int do_subscribe(const char* logger, ls_severity_level_t severity, endpoint_t who, mess_ls_subscribe_reply* reply) {
+	int ret;
+
+	if ((ret = ensure_initialized()) != OK) {
+		return ret;
+	}
+
+	ls_logger_list_t* l = find_logger(logger);
+	if (!l) {
+		LS_LOG_PRINTF(warn, "Logger not found: '%s'", logger);
+		return LS_ERR_NO_SUCH_LOGGER;
+	}
+
+	pid_t pid = getnpid(who);
+	if (pid < 0) {
+		return pid;
+	}
+
+	/* Subscribers that have exited make room for new ones. */
+	int subscriptions = 0;
+	for (int i = 0; i < LS_MAX_SUBSCRIBERS; i++) {
+		ls_subscriber_t* s = g_subscribers[i];
+		if (!s) {
+			continue;
+		}
+
+		if (!subscriber_alive(s)) {
+			subscriber_free(i);
+		} else if (s->who == who && s->logger == l) {
+			LS_LOG_PRINTF(warn, "Pid %d is already subscribed to logger '%s'", who, logger);
+			return EINVAL;
+		} else if (s->who == who) {
+			subscriptions++;
+		}
+	}
+	if (subscriptions >= LS_MAX_SUBSCRIPTIONS_PER_CLIENT) {
+		LS_LOG_PRINTF(warn, "Pid %d has too many subscriptions", who);
+		return LS_ERR_LIMIT_REACHED;
+	}
+
+	int id = 0;
+	while (id < LS_MAX_SUBSCRIBERS && g_subscribers[id]) {
+		id++;
+	}
+	if (id == LS_MAX_SUBSCRIBERS) {
+		LS_LOG_PRINTF(warn, "Too many subscribers, refusing pid %d", who);
+		return LS_ERR_LIMIT_REACHED;
+	}
+
+	ls_subscriber_t* s = malloc(sizeof(ls_subscriber_t));
+	if (!s) {
+		LS_LOG_PUTS(warn, "Out of memory adding a subscriber");
+		return ENOMEM;
+	}
+
+	memset(s, 0, offsetof(ls_subscriber_t, buf));
+	s->who = who;
+	s->pid = pid;
+	s->logger = l;
+	s->severity = severity;
+	g_subscribers[id] = s;
+	g_nsubscribers++;
+
+	LS_LOG_PRINTF(info, "Pid %d subscribed to logger '%s'", who, logger);
+	reply->subscription = id;
+	return OK;
+}
+
+int do_read_subscription(int id, vir_bytes buf, cp_grant_id_t grant, int buf_len, endpoint_t who, mess_ls_read_subscription_reply* reply) {
+	ls_subscriber_t* s = find_subscriber(id, who);
+	if (!s) {
+		return LS_ERR_NO_SUCH_SUBSCRIPTION;
+	}
+
+	if (s->waiting || buf_len < MINIX_LS_MAX_RECORD_LEN) {
+		return EINVAL;
+	}
+
+	if (s->len == 0) {
+		s->waiting = TRUE;
+		s->wait_buf = buf;
+		s->wait_grant = grant;
+		s->wait_len = buf_len;
+		return EDONTREPLY;
+	}
+
+	return subscriber_read(s, buf, grant, buf_len, reply);
+}
+
+int do_unsubscribe(int id, endpoint_t who) {
+	if (!find_subscriber(id, who)) {
+		return LS_ERR_NO_SUCH_SUBSCRIPTION;
+	}
+
+	subscriber_free(id);
+	return OK;
+}
@@ -0,0 +1,111 @@
+#include <sys/errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <syslog.h>
+#include "proto.h"
+#include "mini-printf.h"
+
+/* Forwarding to syslogd. Records for `destination = syslog` sinks are
+ * collected into one buffer as `<pri>line` records separated by newlines, and
+ * the whole buffer is written into the FIFO syslogd reads them from once the
+ * queues have been drained, or when it fills up. syslogd does not have to be
+ * running: the FIFO is (re)opened whenever there is something to send, and
+ * records are kept until it can be written to. */
+
+char g_syslog_buf[LS_SYSLOG_BATCH_LEN];
+int g_syslog_len;
+int g_syslog_fd = -1;
+unsigned int g_syslog_lost;
+
+int syslog_priority(int facility, ls_severity_level_t severity) {
+	switch (severity) {
+		case LS_SEV_TRACE:
+		case LS_SEV_DEBUG:
+			return facility | LOG_DEBUG;
+
+		case LS_SEV_INFO:
+			return facility | LOG_INFO;
+
+		default:
+			return facility | LOG_WARNING;
+	}
+}
+
+/* Writes out as much of the batch as the FIFO takes. Returns FALSE if
+ * anything is left over. */
+int syslog_flush() {
+	if (g_syslog_len == 0) {
+		return TRUE;
+	}
+
+	if (g_syslog_fd < 0) {
+		/* Fails with ENXIO while syslogd is not running. */
+		g_syslog_fd = open(MINIX_LS_SYSLOG_PATH, O_WRONLY | O_NONBLOCK);
+		if (g_syslog_fd < 0) {
+			return FALSE;
+		}
+	}
+
+	int ret = write(g_syslog_fd, g_syslog_buf, g_syslog_len);
+	if (ret < 0) {
+		/* errno is positive, while ls sees the negative error codes of
+		 * _SYSTEM. */
+		if (errno != -EAGAIN) {
+			LS_LOG_PRINTF(warn, "Failed writing to syslogd: %d", errno);
+			close(g_syslog_fd);
+			g_syslog_fd = -1;
+		}
+
+		return FALSE;
+	}
+
+	g_syslog_len -= ret;
+	memmove(g_syslog_buf, g_syslog_buf + ret, g_syslog_len);
+
+	if (g_syslog_lost && g_syslog_len == 0) {
+		LS_LOG_PRINTF(warn, "%u records for syslogd were lost while it was not keeping up", g_syslog_lost);
+		g_syslog_lost = 0;
+	}
+
+	return g_syslog_len == 0;
+}
+
+/* Records that are waiting for syslogd to catch up. Records that are waiting
+ * for syslogd to be started at all do not count; they are only retried along
+ * with the next batch, rather than on every tick. */
+int syslog_pending() {
+	return g_syslog_len > 0 && g_syslog_fd >= 0;
+}
+
+int syslog_append(int facility, ls_severity_level_t severity, const char* line, int len) {
+	char pri[8];
+	int pri_len;
+
+	/* syslogd takes one record per line. */
+	while (len > 0 && line[len - 1] == '\n') {
+		len--;
+	}
+
+	mini_snprintf(pri, sizeof(pri), "<%d>", syslog_priority(facility, severity));
+	pri[sizeof(pri) - 1] = '\0';
+	pri_len = strlen(pri);
+
+	if (pri_len + len + 1 > LS_SYSLOG_BATCH_LEN) {
+		len = LS_SYSLOG_BATCH_LEN - pri_len - 1;
+	}
+
+	if (g_syslog_len + pri_len + len + 1 > LS_SYSLOG_BATCH_LEN && !syslog_flush() &&
+			g_syslog_len + pri_len + len + 1 > LS_SYSLOG_BATCH_LEN) {
+		g_syslog_lost++;
+		return LS_ERR_EXTERNAL;
+	}
+
+	memcpy(g_syslog_buf + g_syslog_len, pri, pri_len);
+	g_syslog_len += pri_len;
+	memcpy(g_syslog_buf + g_syslog_len, line, len);
+	g_syslog_len += len;
+	g_syslog_buf[g_syslog_len++] = '\n';
+
+	return OK;
+}